@@ -1,6 +1,9 @@
 import sys
 import os
-from flask import Flask, render_template, request, jsonify
+import json
+import queue
+import threading
+from flask import Flask, render_template, request, jsonify, Response, stream_with_context
 import markdown
 
 
@@ -13,8 +16,9 @@ import myapp
 app = Flask(__name__)
 
 
-# Инициализация RAG-системы
+# Инициализация RAG-системы: базы данных загружаются в фоне, не задерживая запуск
 rag = myapp.Rag()
+rag.preloadDatabases()
 
 
 # Константа: директория для хранения эталонных файлов
@@ -44,12 +48,14 @@ selected_databases = []
 # - top_k: ограничение на выбор из top-K наиболее вероятных токенов
 # - rag_k: количество документов, извлекаемых при RAG-поиске
 # - rag_sim_threshold: порог схожести для отбора релевантных документов
+# - id_slot: слот llama-server для переиспользования KV-кэша (-1 - любой свободный)
 rag_parameters = {
    'n_predict': 512,
    'temperature': 0.7,
    'top_k': 40,
    'rag_k': 3,
-   'rag_sim_threshold': 0.3
+   'rag_sim_threshold': 0.3,
+   'id_slot': -1
 }
 
 
@@ -72,7 +78,8 @@ def get_ai_response(user_message, selected_databases, rag_params):
        rag_params['temperature'],
        rag_params['top_k'],
        rag_params['rag_k'],
-       rag_params['rag_sim_threshold']
+       rag_params['rag_sim_threshold'],
+       rag_params.get('id_slot', -1)
    )
    html_response = markdown.markdown(response, extensions=['fenced_code'])
    return "Afina: " + html_response
@@ -112,6 +119,59 @@ def chat():
 
 
 
+## @brief Обработчик POST-запроса для потокового ответа чата.
+#
+# Принимает тот же JSON, что и /chat. Генерация выполняется в отдельном потоке,
+# фрагменты ответа передаются клиенту по мере получения от модели в формате
+# NDJSON: строки вида {"token": "..."}, а в конце {"html": "..."} с полным
+# ответом, преобразованным из Markdown, или {"error": "..."} при ошибке.
+#
+# @return Потоковый ответ с MIME-типом application/x-ndjson.
+@app.route('/chat/stream', methods=['POST'])
+def chat_stream():
+   data = request.json
+   user_message = data.get('message')
+   selected_db = data.get('selected_databases', [])
+   rag_params = data.get('rag_parameters', rag_parameters)
+   events = queue.Queue()
+
+
+   def generate_answer():
+       try:
+           answer = rag.requestStream(
+               user_message,
+               selected_db,
+               lambda token: events.put({'token': token}),
+               rag_params['n_predict'],
+               rag_params['temperature'],
+               rag_params['top_k'],
+               rag_params['rag_k'],
+               rag_params['rag_sim_threshold'],
+               rag_params.get('id_slot', -1)
+           )
+           events.put({'html': "Afina: " + markdown.markdown(answer, extensions=['fenced_code'])})
+       except Exception as e:
+           events.put({'error': str(e)})
+       finally:
+           events.put(None)
+
+
+   threading.Thread(target=generate_answer, daemon=True).start()
+
+
+   def stream():
+       while True:
+           event = events.get()
+           if event is None:
+               break
+           yield json.dumps(event, ensure_ascii=False) + '\n'
+
+
+   return Response(stream_with_context(stream()), mimetype='application/x-ndjson')
+
+
+
+
 ## @brief Обработчик загрузки и обработки файлов для создания новой векторной базы данных.
 #
 # Принимает текстовые файлы (.txt), сохраняет их во временную директорию,
@@ -159,25 +219,85 @@ def upload_files():
 
 ## @brief Возвращает список доступных векторных баз данных.
 #
-# Запрашивает у RAG-системы список всех загруженных баз и преобразует их
-# в JSON-совместимый формат с идентификатором и именем файла.
+# Запрашивает у RAG-системы список всех зарегистрированных баз и преобразует их
+# в JSON-совместимый формат с постоянным идентификатором, именем файла и
+# состоянием в памяти (базы загружаются при первом запросе).
+#
+# Базы, загрузка которых ещё идёт при запуске, отмечены "resident": false;
+# ход их загрузки виден в "load_progress".
 #
-# @return JSON-массив объектов с полями "id" и "filename".
+# @return JSON-массив объектов с полями "id", "filename", "resident",
+#         "memory_bytes", "vectors" и "load_progress".
 @app.route('/databases')
 def get_databases():
    try:
-       databases = rag.get_vector_database_list()
        db_list = []
-       for i, db in enumerate(databases):
+       for entry in rag.getDatabaseResidency():
            db_list.append({
-               'id': i,
-               'filename': db.getFilename()
+               'id': entry.id,
+               'filename': entry.name,
+               'resident': entry.resident,
+               'memory_bytes': entry.memory_bytes,
+               'vectors': entry.vectors,
+               'load_progress': entry.load_progress
            })
        return jsonify(db_list)
    except Exception as e:
        return jsonify({'error': str(e)}), 500
 
 
+## @brief Сообщает, завершена ли фоновая загрузка баз данных при запуске.
+#
+# Запросы к ещё не загруженной базе не отклоняются, а ждут её загрузки.
+#
+# @return JSON-объект с полем "ready".
+@app.route('/databases/status')
+def get_databases_status():
+   return jsonify({'ready': rag.databasesReady()})
+
+
+## @brief Возвращает результаты фоновых проверок доступности модели и эмбедера.
+#
+# Проверки выполняются в фоне, поэтому ответ не ждёт серверов.
+#
+# @return JSON-объект с полем "healthy" и списком "backends".
+@app.route('/health')
+def get_health():
+   backends = []
+   for backend in rag.getBackendHealth():
+       backends.append({
+           'name': backend.name,
+           'url': backend.url,
+           'checked': backend.checked,
+           'healthy': backend.healthy,
+           'status_code': backend.status_code,
+           'latency_ms': backend.latency_ms,
+           'seconds_since_check': backend.seconds_since_check,
+           'error': backend.error
+       })
+   return jsonify({'healthy': rag.backendsHealthy(), 'backends': backends})
+
+
+## @brief Возвращает исходные документы, на фрагменты которых ссылаются базы.
+#
+# В режиме ссылок (rag.setSourceReferences) базы хранят не текст фрагментов,
+# а смещения в исходных файлах. Файлы, изменённые или удалённые после
+# индексации, отмечены "stale": их фрагменты не попадают в контекст.
+#
+# @return JSON-объект с полем "references" и списком "documents".
+@app.route('/sources')
+def get_sources():
+   documents = []
+   for document in rag.checkSources():
+       documents.append({
+           'id': document.id,
+           'path': document.path,
+           'size': document.size,
+           'stale': document.stale
+       })
+   return jsonify({'references': rag.getSourceReferences(), 'documents': documents})
+
+
 
 
 ## @brief Обновляет глобальный список выбранных баз данных.
@@ -219,7 +339,8 @@ def update_parameters():
        'temperature': float(data.get('temperature', 0.7)),
        'top_k': int(data.get('top_k', 40)),
        'rag_k': int(data.get('rag_k', 3)),
-       'rag_sim_threshold': float(data.get('rag_sim_threshold', 0.3))
+       'rag_sim_threshold': float(data.get('rag_sim_threshold', 0.3)),
+       'id_slot': int(data.get('id_slot', -1))
    }
    return jsonify({'message': 'Parameters updated', 'parameters': rag_parameters})
 
@@ -0,0 +1,103 @@
+#include "concurrency_limiter.hpp"
+#include <algorithm>
+
+// Через сколько замеров min_rtt сбрасывается, чтобы оценка следовала за изменениями сервера.
+#define MIN_RTT_RESET_SAMPLES 500
+
+ConcurrencyLimiter::Permit::Permit(ConcurrencyLimiter *owner, size_t in_flight_at_start)
+    : owner(owner), in_flight_at_start(in_flight_at_start)
+{
+}
+
+ConcurrencyLimiter::Permit::Permit(Permit &&other) noexcept
+    : owner(other.owner), in_flight_at_start(other.in_flight_at_start)
+{
+    other.owner = nullptr;
+}
+
+ConcurrencyLimiter::Permit::~Permit()
+{
+    if (owner)
+    {
+        owner->onRelease(in_flight_at_start, 0.0, false);
+    }
+}
+
+void ConcurrencyLimiter::Permit::release(double latency_ms, bool ok)
+{
+    if (owner)
+    {
+        owner->onRelease(in_flight_at_start, latency_ms, ok);
+        owner = nullptr;
+    }
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(double initial, double min_limit, double max_limit)
+    : limit(std::clamp(initial, min_limit, max_limit)), min_limit(min_limit), max_limit(max_limit)
+{
+}
+
+ConcurrencyLimiter::Permit ConcurrencyLimiter::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [this]() { return static_cast<double>(in_flight) < limit; });
+    ++in_flight;
+    return Permit(this, in_flight);
+}
+
+std::optional<ConcurrencyLimiter::Permit> ConcurrencyLimiter::tryAcquire()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (static_cast<double>(in_flight) >= limit)
+    {
+        return std::nullopt;
+    }
+    ++in_flight;
+    return Permit(this, in_flight);
+}
+
+void ConcurrencyLimiter::onRelease(size_t in_flight_at_start, double latency_ms, bool ok)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --in_flight;
+
+        if (ok && latency_ms > 0.0)
+        {
+            if (min_rtt_ms == 0.0 || latency_ms < min_rtt_ms || samples_since_reset >= MIN_RTT_RESET_SAMPLES)
+            {
+                min_rtt_ms = latency_ms;
+                samples_since_reset = 0;
+            }
+            ++samples_since_reset;
+        }
+
+        ++releases_since_decrease;
+        if (!ok || latency_ms > tolerance * min_rtt_ms)
+        {
+            // Не чаще раза за окно: ответы, начатые до уменьшения, ещё отражают старый лимит.
+            if (static_cast<double>(releases_since_decrease) >= limit)
+            {
+                limit = std::max(min_limit, limit * backoff);
+                releases_since_decrease = 0;
+            }
+        }
+        else if (static_cast<double>(in_flight_at_start) * 2.0 >= limit)
+        {
+            // Увеличиваем лимит только если он действительно используется.
+            limit = std::min(max_limit, limit + 1.0 / limit);
+        }
+    }
+    released.notify_all();
+}
+
+LimiterStats ConcurrencyLimiter::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return {limit, in_flight, min_rtt_ms};
+}
+
+size_t ConcurrencyLimiter::maxLimit() const
+{
+    return static_cast<size_t>(max_limit);
+}
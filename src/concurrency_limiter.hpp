@@ -0,0 +1,107 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+
+/**
+ * @brief Текущее состояние ограничителя параллелизма.
+ */
+struct LimiterStats
+{
+    double limit = 0;      ///< Текущий допустимый уровень параллелизма.
+    size_t in_flight = 0;  ///< Количество запросов в обработке.
+    double min_rtt_ms = 0; ///< Оценка задержки без нагрузки (мс).
+};
+
+/**
+ * @brief Адаптивный (AIMD) ограничитель количества одновременных запросов к серверу.
+ *
+ * Пока задержка близка к задержке без нагрузки, лимит растёт на единицу за «окно»
+ * запросов (аддитивное увеличение). Если задержка превышает её в `tolerance` раз
+ * или запрос завершился ошибкой, лимит умножается на `backoff` (мультипликативное
+ * уменьшение). Так количество запросов в обработке держится у максимума, который
+ * сервер выдерживает без очередей в слотах.
+ *
+ * Задержки сравниваются между собой, поэтому вызывающая сторона передаёт величину, зависящую
+ * от загрузки сервера, а не от размера запроса: время до первого токена ответа модели или
+ * задержку эмбеддинга в пересчёте на объём текста.
+ */
+class ConcurrencyLimiter
+{
+    mutable std::mutex mutex;
+    std::condition_variable released;
+
+    double limit;
+    const double min_limit;
+    const double max_limit;
+    size_t in_flight = 0;
+
+    double min_rtt_ms = 0;              ///< Минимальная недавняя задержка.
+    size_t samples_since_reset = 0;     ///< Замеров с последнего сброса min_rtt.
+    size_t releases_since_decrease = 0; ///< Ответов с последнего уменьшения лимита.
+    double tolerance = 2.0;             ///< Допустимое превышение min_rtt.
+    double backoff = 0.9;               ///< Коэффициент уменьшения лимита.
+
+public:
+    /**
+     * @brief RAII-разрешение на один запрос.
+     *
+     * Освобождается через release() с замером задержки или в деструкторе как ошибка.
+     */
+    class Permit
+    {
+        ConcurrencyLimiter *owner;
+        size_t in_flight_at_start;
+
+    public:
+        Permit(ConcurrencyLimiter *owner, size_t in_flight_at_start);
+        Permit(Permit &&other) noexcept;
+        Permit(const Permit &) = delete;
+        Permit &operator=(const Permit &) = delete;
+        Permit &operator=(Permit &&) = delete;
+        ~Permit();
+
+        /**
+         * @brief Завершение запроса.
+         *
+         * @param latency_ms - задержка запроса в миллисекундах, нормированная по размеру запроса
+         * @param ok - запрос завершился успешно
+         */
+        void release(double latency_ms, bool ok);
+    };
+
+    /**
+     * @param initial - начальный лимит
+     * @param min_limit - минимальный лимит
+     * @param max_limit - максимальный лимит
+     */
+    ConcurrencyLimiter(double initial, double min_limit, double max_limit);
+
+    /**
+     * @brief Ожидает, пока количество запросов в обработке не опустится ниже лимита.
+     *
+     * @return Permit - разрешение на выполнение запроса
+     */
+    Permit acquire();
+
+    /**
+     * @brief Разрешение без ожидания.
+     *
+     * @return Permit или пусто, если лимит занят
+     */
+    std::optional<Permit> tryAcquire();
+
+    /**
+     * @brief Текущее состояние ограничителя.
+     */
+    LimiterStats stats() const;
+
+    /**
+     * @brief Максимально возможный лимит.
+     */
+    size_t maxLimit() const;
+
+private:
+    void onRelease(size_t in_flight_at_start, double latency_ms, bool ok);
+};
@@ -0,0 +1,188 @@
+#include "context_compressor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+std::string trim(const std::string &text)
+{
+    auto begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos)
+    {
+        return "";
+    }
+    auto end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+float cosine(const std::vector<float> &a, const std::vector<float> &b)
+{
+    if (a.size() != b.size() || a.empty())
+    {
+        return -1.0f;
+    }
+    float dot = 0.0f;
+    float norm_a = 0.0f;
+    float norm_b = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        dot += a[i] * b[i];
+        norm_a += a[i] * a[i];
+        norm_b += b[i] * b[i];
+    }
+    if (norm_a == 0.0f || norm_b == 0.0f)
+    {
+        return -1.0f;
+    }
+    return dot / (std::sqrt(norm_a) * std::sqrt(norm_b));
+}
+
+struct Sentence
+{
+    size_t fragment;
+    size_t order;
+    float score;
+    size_t tokens;
+    std::string text;
+};
+} // namespace
+
+ContextCompressor::ContextCompressor(EmbedBatch embed_batch, ContextPacker::TokenCounter count_tokens)
+    : embed_batch(std::move(embed_batch)), count_tokens(std::move(count_tokens))
+{
+}
+
+std::vector<ContextCandidate> ContextCompressor::compress(std::vector<ContextCandidate> fragments,
+                                                          const std::vector<float> &query,
+                                                          size_t token_budget) const
+{
+    std::vector<Sentence> sentences;
+    std::vector<std::string> texts;
+    for (size_t f = 0; f < fragments.size(); ++f)
+    {
+        for (auto &sentence : splitSentences(fragments[f].text))
+        {
+            texts.push_back(sentence);
+            sentences.push_back({f, sentences.size(), 0.0f, 0, std::move(sentence)});
+        }
+    }
+    if (sentences.empty())
+    {
+        return fragments;
+    }
+
+    auto embeddings = embed_batch(texts);
+    for (size_t i = 0; i < sentences.size() && i < embeddings.size(); ++i)
+    {
+        sentences[i].score = cosine(query, embeddings[i]);
+    }
+
+    // Токенизатор считает целые фрагменты (их немного), а между предложениями фрагмента
+    // количество токенов делится пропорционально оценке estimateTokens.
+    std::vector<std::string> fragment_texts;
+    fragment_texts.reserve(fragments.size());
+    for (const auto &fragment : fragments)
+    {
+        fragment_texts.push_back(fragment.text);
+    }
+    auto fragment_tokens = count_tokens(fragment_texts);
+    std::vector<size_t> estimated(fragments.size(), 0);
+    for (auto &sentence : sentences)
+    {
+        sentence.tokens = ContextPacker::estimateTokens(sentence.text);
+        estimated[sentence.fragment] += sentence.tokens;
+    }
+    for (auto &sentence : sentences)
+    {
+        if (sentence.fragment < fragment_tokens.size())
+        {
+            size_t share = (fragment_tokens[sentence.fragment] * sentence.tokens + estimated[sentence.fragment] / 2) /
+                           estimated[sentence.fragment];
+            sentence.tokens = std::max<size_t>(share, 1);
+        }
+    }
+
+    std::stable_sort(sentences.begin(),
+                     sentences.end(),
+                     [](const Sentence &a, const Sentence &b) { return a.score > b.score; });
+
+    std::vector<Sentence> kept;
+    size_t remaining = token_budget;
+    for (auto &sentence : sentences)
+    {
+        if (sentence.tokens <= remaining)
+        {
+            remaining -= sentence.tokens;
+            kept.push_back(std::move(sentence));
+        }
+    }
+
+    // Предложения возвращаются в исходном порядке, чтобы текст оставался связным.
+    std::sort(kept.begin(), kept.end(), [](const Sentence &a, const Sentence &b) { return a.order < b.order; });
+
+    std::vector<std::string> compressed(fragments.size());
+    for (const auto &sentence : kept)
+    {
+        auto &text = compressed[sentence.fragment];
+        if (!text.empty())
+        {
+            text += " ";
+        }
+        text += sentence.text;
+    }
+
+    std::vector<ContextCandidate> result;
+    for (size_t f = 0; f < fragments.size(); ++f)
+    {
+        if (!compressed[f].empty())
+        {
+            fragments[f].text = std::move(compressed[f]);
+            result.push_back(std::move(fragments[f]));
+        }
+    }
+    return result;
+}
+
+std::vector<std::string> ContextCompressor::splitSentences(const std::string &text)
+{
+    std::vector<std::string> sentences;
+    size_t start = 0;
+    auto cut = [&](size_t end)
+    {
+        auto sentence = trim(text.substr(start, end - start));
+        if (!sentence.empty())
+        {
+            sentences.push_back(std::move(sentence));
+        }
+        start = end;
+    };
+
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        char c = text[i];
+        if (c == '\n')
+        {
+            cut(i + 1);
+            continue;
+        }
+
+        size_t end = 0;
+        if (c == '.' || c == '!' || c == '?')
+        {
+            end = i + 1;
+        }
+        else if (text.compare(i, 3, "\xE2\x80\xA6") == 0) // '…'
+        {
+            end = i + 3;
+            i += 2;
+        }
+
+        if (end != 0 && (end == text.size() || text[end] == ' ' || text[end] == '\n' || text[end] == '\t'))
+        {
+            cut(end);
+        }
+    }
+    cut(text.size());
+    return sentences;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "context_packer.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Экстрактивное сжатие контекста перед генерацией.
+ *
+ * Фрагменты разбиваются на предложения, предложения получают эмбеддинги одним
+ * пакетным запросом и ранжируются по косинусному сходству с вопросом. В контексте
+ * остаются лучшие предложения в пределах бюджета, в исходном порядке. Токены фрагментов
+ * считаются той же функцией, что и в ContextPacker, и делятся между предложениями фрагмента
+ * пропорционально оценке ContextPacker::estimateTokens.
+ */
+class ContextCompressor
+{
+public:
+    using EmbedBatch = std::function<std::vector<std::vector<float>>(const std::vector<std::string> &)>;
+
+    /**
+     * @param embed_batch - функция получения эмбеддингов для набора текстов
+     * @param count_tokens - функция подсчёта токенов в каждом из текстов (один вызов на все фрагменты)
+     */
+    ContextCompressor(EmbedBatch embed_batch, ContextPacker::TokenCounter count_tokens);
+
+    /**
+     * @brief Оставляет во фрагментах только наиболее релевантные вопросу предложения.
+     *
+     * @param fragments - фрагменты контекста
+     * @param query - эмбеддинг вопроса
+     * @param token_budget - максимальное количество токенов сжатого контекста
+     * @return std::vector<ContextCandidate> - фрагменты с сокращённым текстом; пустые фрагменты удаляются
+     */
+    std::vector<ContextCandidate> compress(std::vector<ContextCandidate> fragments,
+                                           const std::vector<float> &query,
+                                           size_t token_budget) const;
+
+    /**
+     * @brief Разбиение текста на предложения.
+     *
+     * Граница предложения - '.', '!', '?' или '…' с последующим пробелом, либо перевод строки.
+     *
+     * @param text - текст в UTF-8
+     * @return std::vector<std::string> - непустые предложения
+     */
+    static std::vector<std::string> splitSentences(const std::string &text);
+
+private:
+    EmbedBatch embed_batch;
+    ContextPacker::TokenCounter count_tokens;
+};
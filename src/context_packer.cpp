@@ -0,0 +1,152 @@
+#include "context_packer.hpp"
+#include <algorithm>
+#include <tuple>
+#include <unordered_set>
+#include <utility>
+
+// Минимальная длина совпадения конца одного фрагмента с началом другого (байт),
+// при которой фрагменты считаются пересекающимися.
+#define MIN_OVERLAP 32
+
+namespace
+{
+bool byPosition(const ContextCandidate &a, const ContextCandidate &b)
+{
+    return std::tie(a.database_id, a.position) < std::tie(b.database_id, b.position);
+}
+
+/**
+ * @brief Длина наибольшего суффикса left, совпадающего с префиксом right.
+ */
+size_t overlapLength(const std::string &left, const std::string &right)
+{
+    for (size_t k = std::min(left.size(), right.size()); k >= MIN_OVERLAP; --k)
+    {
+        if (left.compare(left.size() - k, k, right, 0, k) == 0)
+        {
+            return k;
+        }
+    }
+    return 0;
+}
+} // namespace
+
+ContextPacker::ContextPacker(TokenCounter count_tokens) : count_tokens(std::move(count_tokens))
+{
+}
+
+std::vector<ContextCandidate> ContextPacker::pack(std::vector<ContextCandidate> candidates, size_t token_budget) const
+{
+    auto fragments = unique(std::move(candidates));
+    if (token_budget == 0)
+    {
+        std::sort(fragments.begin(), fragments.end(), byPosition);
+        return merge(std::move(fragments));
+    }
+
+    // Бюджет считается по отдельным фрагментам до склейки: склейка только убирает
+    // повторы на стыках и не увеличивает количество токенов.
+    std::vector<std::string> texts;
+    texts.reserve(fragments.size());
+    for (const auto &fragment : fragments)
+    {
+        texts.push_back(fragment.text);
+    }
+    auto tokens = count_tokens(texts);
+
+    std::vector<ContextCandidate> selected;
+    size_t remaining = token_budget;
+    for (size_t i = 0; i < fragments.size() && remaining > 0; ++i)
+    {
+        // Фрагмент, не поместившийся целиком, пропускается: следующий по сходству может быть короче.
+        if (tokens[i] <= remaining)
+        {
+            remaining -= tokens[i];
+            selected.push_back(std::move(fragments[i]));
+        }
+    }
+
+    std::sort(selected.begin(), selected.end(), byPosition);
+    return merge(std::move(selected));
+}
+
+size_t ContextPacker::estimateTokens(const std::string &text)
+{
+    size_t code_points = 0;
+    for (unsigned char c : text)
+    {
+        if ((c & 0xC0) != 0x80)
+        {
+            ++code_points;
+        }
+    }
+    // В среднем около трёх символов на токен для русского и английского текста.
+    return code_points / 3 + 1;
+}
+
+std::vector<ContextCandidate> ContextPacker::unique(std::vector<ContextCandidate> candidates)
+{
+    // Одинаковый текст (в том числе из разных БД) оставляем один раз, с наибольшим сходством.
+    // Результат упорядочен по убыванию сходства.
+    std::stable_sort(candidates.begin(),
+                     candidates.end(),
+                     [](const ContextCandidate &a, const ContextCandidate &b) { return a.score > b.score; });
+    std::unordered_set<std::string> seen;
+    std::vector<ContextCandidate> result;
+    for (auto &candidate : candidates)
+    {
+        if (seen.insert(candidate.text).second)
+        {
+            result.push_back(std::move(candidate));
+        }
+    }
+    return result;
+}
+
+std::vector<ContextCandidate> ContextPacker::merge(std::vector<ContextCandidate> candidates)
+{
+    std::vector<ContextCandidate> merged;
+    uint64_t last_position = 0; ///< Последняя позиция, вошедшая в merged.back().
+    uint64_t last_end = 0;      ///< Конец merged.back() в документе (если документ известен).
+    for (auto &candidate : candidates)
+    {
+        uint64_t end = candidate.offset + candidate.text.size();
+        if (!merged.empty() && merged.back().database_id == candidate.database_id &&
+            merged.back().document == candidate.document && candidate.position == last_position + 1)
+        {
+            auto &last = merged.back();
+            bool joined = false;
+            if (candidate.document >= 0 && candidate.offset >= last.offset)
+            {
+                // Смежные участки файла склеиваются как есть, между абзацами остаётся перевод строки.
+                if (candidate.offset > last_end)
+                {
+                    last.text += "\n" + candidate.text;
+                }
+                else if (end > last_end)
+                {
+                    last.text += candidate.text.substr(last_end - candidate.offset);
+                }
+                joined = true;
+            }
+            else if (candidate.document < 0)
+            {
+                // Соседние позиции - подряд идущие куски текста (Rag::splitChunks режет без
+                // перекрытия), поэтому они склеиваются как есть; совпадающий стык убирается.
+                last.text += candidate.text.substr(overlapLength(last.text, candidate.text));
+                joined = true;
+            }
+            if (joined)
+            {
+                last.score = std::max(last.score, candidate.score);
+                last_position = candidate.position;
+                last_end = std::max(last_end, end);
+                continue;
+            }
+        }
+        last_position = candidate.position;
+        last_end = end;
+        merged.push_back(std::move(candidate));
+    }
+    return merged;
+}
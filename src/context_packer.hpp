@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Фрагмент, найденный в векторной БД и претендующий на место в контексте.
+ */
+struct ContextCandidate
+{
+    int database_id = 0;   ///< Индекс БД в Rag.
+    uint64_t position = 0; ///< Позиция фрагмента в БД (порядок добавления).
+    uint64_t id = 0;       ///< ID записи в БД.
+    float score = 0;       ///< Косинусное сходство с вопросом.
+    std::string text;      ///< Текст фрагмента.
+    int64_t document = -1; ///< Исходный документ в SourceStore (-1 - неизвестен).
+    uint64_t offset = 0;   ///< Смещение фрагмента в документе (если документ известен).
+};
+
+/**
+ * @brief Сборщик контекста с ограничением по количеству токенов.
+ *
+ * Удаляет дубликаты, жадно по убыванию сходства набирает фрагменты, пока они помещаются
+ * в бюджет, затем склеивает отобранные соседние фрагменты одного документа.
+ */
+class ContextPacker
+{
+public:
+    using TokenCounter = std::function<std::vector<size_t>(const std::vector<std::string> &)>;
+
+    /**
+     * @param count_tokens - функция подсчёта токенов в каждом из текстов (один вызов на все фрагменты)
+     */
+    explicit ContextPacker(TokenCounter count_tokens);
+
+    /**
+     * @brief Отбор фрагментов в пределах бюджета.
+     *
+     * @param candidates - найденные фрагменты
+     * @param token_budget - максимальное количество токенов контекста (0 - без ограничения)
+     * @return std::vector<ContextCandidate> - отобранные фрагменты, упорядоченные по (БД, позиция)
+     */
+    std::vector<ContextCandidate> pack(std::vector<ContextCandidate> candidates, size_t token_budget) const;
+
+    /**
+     * @brief Грубая оценка количества токенов без обращения к токенизатору.
+     *
+     * @param text - текст в UTF-8
+     * @return size_t - оценка количества токенов
+     */
+    static size_t estimateTokens(const std::string &text);
+
+private:
+    TokenCounter count_tokens;
+
+    /**
+     * @brief Удаление дубликатов: одинаковый текст остаётся один раз, с наибольшим сходством.
+     */
+    static std::vector<ContextCandidate> unique(std::vector<ContextCandidate> candidates);
+
+    /**
+     * @brief Склейка соседних (по позиции в БД) фрагментов одного документа.
+     *
+     * Фрагменты известного документа склеиваются по смещениям без искажения текста;
+     * фрагменты без документа - подряд, с удалением совпадающего стыка, если он есть.
+     */
+    static std::vector<ContextCandidate> merge(std::vector<ContextCandidate> candidates);
+};
@@ -0,0 +1,109 @@
+#include "database_registry.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+DatabaseRegistry::DatabaseRegistry() : state(std::make_shared<const State>())
+{
+}
+
+int DatabaseRegistry::add(const std::string &name, std::shared_ptr<VectorDatabase> database, bool reserved)
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    auto current = load();
+    if (current->name_to_entry.count(name) != 0 || reserved_names.count(name) != static_cast<size_t>(reserved))
+    {
+        throw std::runtime_error("Database already exists: " + name);
+    }
+    reserved_names.erase(name);
+
+    auto next = std::make_shared<State>(*current);
+    int id = next_id++;
+    next->name_to_entry[name] = next->entries.size();
+    next->entries.push_back({id, name, std::move(database)});
+    std::atomic_store(&state, std::shared_ptr<const State>(std::move(next)));
+    return id;
+}
+
+void DatabaseRegistry::reserve(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (load()->name_to_entry.count(name) != 0 || !reserved_names.insert(name).second)
+    {
+        throw std::runtime_error("Database already exists: " + name);
+    }
+}
+
+void DatabaseRegistry::release(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    reserved_names.erase(name);
+}
+
+bool DatabaseRegistry::remove(int id)
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    auto current = load();
+    if (findEntry(*current, id) == nullptr)
+    {
+        return false;
+    }
+
+    auto next = std::make_shared<State>();
+    for (const auto &entry : current->entries)
+    {
+        if (entry.id != id)
+        {
+            next->name_to_entry[entry.name] = next->entries.size();
+            next->entries.push_back(entry);
+        }
+    }
+    std::atomic_store(&state, std::shared_ptr<const State>(std::move(next)));
+    return true;
+}
+
+std::shared_ptr<VectorDatabase> DatabaseRegistry::find(int id) const
+{
+    auto snapshot = load();
+    auto entry = findEntry(*snapshot, id);
+    return entry != nullptr ? entry->database : nullptr;
+}
+
+std::shared_ptr<VectorDatabase> DatabaseRegistry::find(const std::string &name) const
+{
+    auto snapshot = load();
+    auto it = snapshot->name_to_entry.find(name);
+    return it != snapshot->name_to_entry.end() ? snapshot->entries[it->second].database : nullptr;
+}
+
+int DatabaseRegistry::idOf(const std::string &name) const
+{
+    auto snapshot = load();
+    auto it = snapshot->name_to_entry.find(name);
+    return it != snapshot->name_to_entry.end() ? snapshot->entries[it->second].id : -1;
+}
+
+std::vector<DatabaseEntry> DatabaseRegistry::list() const
+{
+    return load()->entries;
+}
+
+size_t DatabaseRegistry::size() const
+{
+    return load()->entries.size();
+}
+
+std::shared_ptr<const DatabaseRegistry::State> DatabaseRegistry::load() const
+{
+    return std::atomic_load(&state);
+}
+
+const DatabaseEntry *DatabaseRegistry::findEntry(const State &snapshot, int id)
+{
+    // Идентификаторы выдаются по возрастанию, поэтому записи отсортированы по id.
+    auto it = std::lower_bound(snapshot.entries.begin(),
+                               snapshot.entries.end(),
+                               id,
+                               [](const DatabaseEntry &entry, int value) { return entry.id < value; });
+    return it != snapshot.entries.end() && it->id == id ? &*it : nullptr;
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include "vector_db.hpp"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief Запись реестра векторных БД.
+ */
+struct DatabaseEntry
+{
+    int id = -1;                              ///< Постоянный идентификатор БД (не переиспользуется).
+    std::string name;                         ///< Уникальное имя БД (имя файла).
+    std::shared_ptr<VectorDatabase> database; ///< БД.
+};
+
+/**
+ * @brief Потокобезопасный реестр векторных БД с поиском по идентификатору и по имени.
+ *
+ * Состояние реестра - неизменяемый снимок, который читатели атомарно загружают без
+ * блокировок. Изменения сериализуются мьютексом: писатель копирует таблицу указателей,
+ * вносит изменение и публикует новый снимок. Сами БД при этом не копируются, а запросы,
+ * уже получившие указатель на БД, продолжают работать с ней.
+ */
+class DatabaseRegistry
+{
+public:
+    DatabaseRegistry();
+
+    /**
+     * @brief Регистрация БД.
+     *
+     * @param name - уникальное имя
+     * @param database - БД
+     * @param reserved - имя зарезервировано вызывающим через reserve(); резерв снимается
+     * @return int - идентификатор БД
+     * @throws std::runtime_error, если имя уже занято или зарезервировано другим
+     */
+    int add(const std::string &name, std::shared_ptr<VectorDatabase> database, bool reserved = false);
+
+    /**
+     * @brief Зарезервировать имя для БД, которая будет зарегистрирована позже.
+     *
+     * Зарезервированное имя не видно читателям, но не может быть занято другой БД,
+     * пока резерв не снят через add(..., true) или release().
+     *
+     * @throws std::runtime_error, если имя уже занято или зарезервировано
+     */
+    void reserve(const std::string &name);
+
+    /**
+     * @brief Снять резерв имени, если БД так и не была зарегистрирована.
+     */
+    void release(const std::string &name);
+
+    /**
+     * @brief Снять БД с регистрации.
+     *
+     * @param id - идентификатор БД
+     * @return true, если БД была зарегистрирована
+     */
+    bool remove(int id);
+
+    /**
+     * @brief БД по идентификатору.
+     *
+     * @return std::shared_ptr<VectorDatabase> - БД или nullptr
+     */
+    std::shared_ptr<VectorDatabase> find(int id) const;
+
+    /**
+     * @brief БД по имени.
+     *
+     * @return std::shared_ptr<VectorDatabase> - БД или nullptr
+     */
+    std::shared_ptr<VectorDatabase> find(const std::string &name) const;
+
+    /**
+     * @brief Идентификатор БД по имени.
+     *
+     * @return int - идентификатор или -1
+     */
+    int idOf(const std::string &name) const;
+
+    /**
+     * @brief Все зарегистрированные БД в порядке идентификаторов.
+     */
+    std::vector<DatabaseEntry> list() const;
+
+    /**
+     * @brief Количество зарегистрированных БД.
+     */
+    size_t size() const;
+
+private:
+    struct State
+    {
+        std::vector<DatabaseEntry> entries;                    ///< Упорядочены по id.
+        std::unordered_map<std::string, size_t> name_to_entry; ///< Индекс в entries по имени.
+    };
+
+    std::shared_ptr<const State> state; ///< Только через std::atomic_load/atomic_store.
+    std::mutex write_mutex;
+    int next_id = 0;
+    std::unordered_set<std::string> reserved_names; ///< Под write_mutex.
+
+    std::shared_ptr<const State> load() const;
+
+    /**
+     * @brief Поиск записи по идентификатору в снимке.
+     *
+     * @return const DatabaseEntry* - запись или nullptr
+     */
+    static const DatabaseEntry *findEntry(const State &snapshot, int id);
+};
@@ -0,0 +1,339 @@
+#include "embedding_codec.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/// Точность частот rANS (сумма частот = 1 << RANS_SCALE_BITS).
+#define RANS_SCALE_BITS 12
+/// Нижняя граница состояния rANS.
+#define RANS_LOWER_BOUND (1u << 23)
+
+namespace
+{
+/// Способ хранения плоскости.
+enum PlaneMethod : uint8_t
+{
+    plane_raw = 0,      ///< Байты как есть.
+    plane_constant = 1, ///< Все байты одинаковы: хранится один байт.
+    plane_rans = 2      ///< Таблица частот (256 x uint16) и поток rANS.
+};
+
+/// Способ подготовки значений блока.
+enum BlockMode : uint8_t
+{
+    block_plain = 0,   ///< Без преобразования.
+    block_centroid = 1 ///< XOR с центроидом блока (dimension x float32 перед плоскостями).
+};
+
+void appendValue(std::string &output, const void *value, size_t size)
+{
+    output.append(static_cast<const char *>(value), size);
+}
+
+/**
+ * @brief Частоты символов, нормированные к сумме 1 << RANS_SCALE_BITS.
+ *
+ * Каждый встретившийся символ получает ненулевую частоту.
+ */
+std::vector<uint32_t> normalizedFrequencies(const uint8_t *data, size_t size)
+{
+    std::vector<uint64_t> counts(256, 0);
+    for (size_t i = 0; i < size; ++i)
+    {
+        ++counts[data[i]];
+    }
+
+    const uint32_t total = 1u << RANS_SCALE_BITS;
+    std::vector<uint32_t> frequencies(256, 0);
+    uint32_t sum = 0;
+    size_t largest = 0;
+    for (size_t symbol = 0; symbol < 256; ++symbol)
+    {
+        if (counts[symbol] == 0)
+        {
+            continue;
+        }
+        frequencies[symbol] = std::max<uint32_t>(1, static_cast<uint32_t>(counts[symbol] * total / size));
+        sum += frequencies[symbol];
+        if (frequencies[symbol] > frequencies[largest])
+        {
+            largest = symbol;
+        }
+    }
+    // Округление поправляется на самом частом символе: ему разница стоит меньше всего.
+    if (sum <= total || frequencies[largest] > sum - total)
+    {
+        frequencies[largest] = frequencies[largest] + total - sum;
+        return frequencies;
+    }
+    // Много редких символов, поднятых до 1: излишек снимается со всех символов понемногу.
+    while (sum > total)
+    {
+        for (size_t symbol = 0; symbol < 256 && sum > total; ++symbol)
+        {
+            if (frequencies[symbol] > 1)
+            {
+                --frequencies[symbol];
+                --sum;
+            }
+        }
+    }
+    return frequencies;
+}
+
+void encodePlane(const uint8_t *data, size_t size, std::string &output)
+{
+    size_t first_differs = 1;
+    while (first_differs < size && data[first_differs] == data[0])
+    {
+        ++first_differs;
+    }
+    if (size > 0 && first_differs == size)
+    {
+        output.push_back(static_cast<char>(plane_constant));
+        output.push_back(static_cast<char>(data[0]));
+        return;
+    }
+
+    auto frequencies = normalizedFrequencies(data, size);
+    std::vector<uint32_t> starts(256, 0);
+    for (size_t symbol = 1; symbol < 256; ++symbol)
+    {
+        starts[symbol] = starts[symbol - 1] + frequencies[symbol - 1];
+    }
+
+    // Символ с частотой f стоит не больше RANS_SCALE_BITS бит, поэтому буфера 2 x size достаточно.
+    std::vector<uint8_t> buffer(2 * size + 16);
+    uint8_t *end = buffer.data() + buffer.size();
+    uint8_t *pos = end;
+    uint32_t state = RANS_LOWER_BOUND;
+    for (size_t i = size; i-- > 0;)
+    {
+        uint32_t frequency = frequencies[data[i]];
+        uint32_t limit = ((RANS_LOWER_BOUND >> RANS_SCALE_BITS) << 8) * frequency;
+        while (state >= limit)
+        {
+            *--pos = static_cast<uint8_t>(state & 0xFF);
+            state >>= 8;
+        }
+        state = ((state / frequency) << RANS_SCALE_BITS) + state % frequency + starts[data[i]];
+    }
+    pos -= 4;
+    std::memcpy(pos, &state, sizeof(state));
+
+    uint32_t payload = static_cast<uint32_t>(256 * sizeof(uint16_t) + (end - pos));
+    if (payload >= size)
+    {
+        output.push_back(static_cast<char>(plane_raw));
+        appendValue(output, data, size);
+        return;
+    }
+    output.push_back(static_cast<char>(plane_rans));
+    appendValue(output, &payload, sizeof(payload));
+    for (size_t symbol = 0; symbol < 256; ++symbol)
+    {
+        uint16_t frequency = static_cast<uint16_t>(frequencies[symbol]);
+        appendValue(output, &frequency, sizeof(frequency));
+    }
+    appendValue(output, pos, end - pos);
+}
+
+/**
+ * @brief Чтение с проверкой границ.
+ */
+struct Reader
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+
+    bool read(void *value, size_t size)
+    {
+        if (static_cast<size_t>(end - pos) < size)
+        {
+            return false;
+        }
+        std::memcpy(value, pos, size);
+        pos += size;
+        return true;
+    }
+};
+
+bool decodePlane(Reader &input, uint8_t *data, size_t size)
+{
+    uint8_t method;
+    if (!input.read(&method, sizeof(method)))
+    {
+        return false;
+    }
+    if (method == plane_raw)
+    {
+        return input.read(data, size);
+    }
+    if (method == plane_constant)
+    {
+        uint8_t value;
+        if (!input.read(&value, sizeof(value)))
+        {
+            return false;
+        }
+        std::memset(data, value, size);
+        return true;
+    }
+
+    uint32_t payload;
+    if (method != plane_rans || !input.read(&payload, sizeof(payload)) ||
+        payload < 256 * sizeof(uint16_t) + sizeof(uint32_t) || static_cast<size_t>(input.end - input.pos) < payload)
+    {
+        return false;
+    }
+    const uint8_t *end = input.pos + payload;
+
+    uint32_t frequencies[256];
+    uint32_t starts[256];
+    std::vector<uint8_t> symbols(size_t(1) << RANS_SCALE_BITS);
+    uint32_t total = 0;
+    for (size_t symbol = 0; symbol < 256; ++symbol)
+    {
+        uint16_t frequency;
+        if (!input.read(&frequency, sizeof(frequency)))
+        {
+            return false;
+        }
+        frequencies[symbol] = frequency;
+        starts[symbol] = total;
+        if (total + frequency > symbols.size())
+        {
+            return false;
+        }
+        std::memset(symbols.data() + total, static_cast<int>(symbol), frequency);
+        total += frequency;
+    }
+    if (total != symbols.size())
+    {
+        return false;
+    }
+
+    uint32_t state;
+    if (!input.read(&state, sizeof(state)))
+    {
+        return false;
+    }
+    const uint32_t mask = (1u << RANS_SCALE_BITS) - 1;
+    for (size_t i = 0; i < size; ++i)
+    {
+        uint32_t slot = state & mask;
+        uint8_t symbol = symbols[slot];
+        data[i] = symbol;
+        state = frequencies[symbol] * (state >> RANS_SCALE_BITS) + slot - starts[symbol];
+        while (state < RANS_LOWER_BOUND)
+        {
+            if (input.pos == end)
+            {
+                return false;
+            }
+            state = (state << 8) | *input.pos++;
+        }
+    }
+    // Кодер начинал с нижней границы: другое конечное состояние - признак повреждения.
+    return state == RANS_LOWER_BOUND && input.pos == end;
+}
+
+/**
+ * @brief Блок с заданным способом подготовки значений.
+ */
+void encodeBlock(const uint32_t *bits, size_t rows, size_t dimension, const uint32_t *centroid, std::string &output)
+{
+    size_t count = rows * dimension;
+    output.push_back(static_cast<char>(centroid ? block_centroid : block_plain));
+    if (centroid)
+    {
+        appendValue(output, centroid, dimension * sizeof(uint32_t));
+    }
+
+    std::vector<uint8_t> plane(count);
+    for (unsigned byte = 0; byte < 4; ++byte)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint32_t value = centroid ? bits[i] ^ centroid[i % dimension] : bits[i];
+            plane[i] = static_cast<uint8_t>(value >> (8 * byte));
+        }
+        encodePlane(plane.data(), count, output);
+    }
+}
+} // namespace
+
+namespace embedding_codec
+{
+void encode(const float *data, size_t rows, size_t dimension, std::string &output)
+{
+    size_t count = rows * dimension;
+    if (count == 0)
+    {
+        output.push_back(static_cast<char>(block_plain));
+        return;
+    }
+    std::vector<uint32_t> bits(count);
+    std::memcpy(bits.data(), data, count * sizeof(float));
+
+    std::vector<double> sums(dimension, 0.0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        sums[i % dimension] += data[i];
+    }
+    std::vector<uint32_t> centroid(dimension);
+    for (size_t j = 0; j < dimension; ++j)
+    {
+        float mean = rows > 0 ? static_cast<float>(sums[j] / rows) : 0.0f;
+        std::memcpy(&centroid[j], &mean, sizeof(mean));
+    }
+
+    // Выигрыш от центроида зависит от данных, поэтому сохраняется меньший из двух вариантов.
+    std::string plain;
+    std::string centered;
+    encodeBlock(bits.data(), rows, dimension, nullptr, plain);
+    encodeBlock(bits.data(), rows, dimension, centroid.data(), centered);
+    output.append(centered.size() < plain.size() ? centered : plain);
+}
+
+bool decode(const char *input, size_t size, float *output, size_t rows, size_t dimension)
+{
+    Reader reader{reinterpret_cast<const uint8_t *>(input), reinterpret_cast<const uint8_t *>(input) + size};
+    uint8_t mode;
+    if (!reader.read(&mode, sizeof(mode)) || (mode != block_plain && mode != block_centroid))
+    {
+        return false;
+    }
+    std::vector<uint32_t> centroid(dimension, 0);
+    if (mode == block_centroid && !reader.read(centroid.data(), dimension * sizeof(uint32_t)))
+    {
+        return false;
+    }
+
+    size_t count = rows * dimension;
+    if (count == 0)
+    {
+        return mode == block_plain && reader.pos == reader.end;
+    }
+    std::vector<uint32_t> bits(count, 0);
+    std::vector<uint8_t> plane(count);
+    for (unsigned byte = 0; byte < 4; ++byte)
+    {
+        if (!decodePlane(reader, plane.data(), count))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            bits[i] |= uint32_t(plane[i]) << (8 * byte);
+        }
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        bits[i] ^= centroid[i % dimension];
+    }
+    std::memcpy(output, bits.data(), count * sizeof(float));
+    return reader.pos == reader.end;
+}
+} // namespace embedding_codec
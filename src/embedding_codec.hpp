@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Сжатие матрицы эмбеддингов без потерь.
+ *
+ * Байты float32 раскладываются по четырём плоскостям (байт 0 всех значений, байт 1 и т.д.),
+ * и каждая плоскость кодируется энтропийным кодером rANS. Старшие байты (знак и порядок)
+ * сжимаются хорошо, младшие байты мантиссы почти случайны и хранятся как есть, если
+ * кодирование их не уменьшает. Перед разбиением значения могут быть сложены по XOR
+ * с центроидом блока (средним по каждой координате): близкие к центроиду значения
+ * совпадают с ним в старших битах. Восстановление побитово точное.
+ */
+namespace embedding_codec
+{
+/**
+ * @brief Сжать блок строк.
+ *
+ * @param data - значения (rows x dimension)
+ * @param rows - количество строк
+ * @param dimension - размерность
+ * @param output - сюда дописывается сжатый блок
+ */
+void encode(const float *data, size_t rows, size_t dimension, std::string &output);
+
+/**
+ * @brief Распаковать блок строк.
+ *
+ * @param input - сжатый блок
+ * @param size - размер сжатого блока
+ * @param output - значения (rows x dimension)
+ * @return true, если блок распакован; false, если данные повреждены
+ */
+bool decode(const char *input, size_t size, float *output, size_t rows, size_t dimension);
+} // namespace embedding_codec
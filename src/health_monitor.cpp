@@ -0,0 +1,149 @@
+#include "health_monitor.hpp"
+#include "cpr/api.h"
+#include <iostream>
+
+/// Время ожидания ответа на проверку (мс).
+#define HEALTH_TIMEOUT_MS 2000
+/// Путь проверки готовности llama-server (200 - модель загружена и принимает запросы).
+#define HEALTH_PATH "/health"
+/// HTTP-код готового сервера.
+#define HEALTH_OK 200
+
+namespace
+{
+/**
+ * @brief Адрес проверки готовности на том же сервере, что и url.
+ */
+std::string healthUrl(const std::string &url)
+{
+    // Путь начинается после "схема://хост:порт".
+    auto host = url.find("://");
+    auto path = url.find('/', host == std::string::npos ? 0 : host + 3);
+    return url.substr(0, path) + HEALTH_PATH;
+}
+} // namespace
+
+HealthMonitor::HealthMonitor(std::vector<std::pair<std::string, cpr::Url>> backends,
+                             std::chrono::milliseconds interval)
+    : interval(interval)
+{
+    for (auto &backend : backends)
+    {
+        Backend entry;
+        entry.health.name = std::move(backend.first);
+        entry.health.url = healthUrl(backend.second.str());
+        this->backends.push_back(std::move(entry));
+    }
+}
+
+HealthMonitor::~HealthMonitor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+}
+
+void HealthMonitor::start()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!worker.joinable())
+    {
+        worker = std::thread([this]() { run(); });
+    }
+}
+
+void HealthMonitor::checkNow()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        check_requested = true;
+    }
+    wake.notify_all();
+}
+
+void HealthMonitor::setInterval(std::chrono::milliseconds new_interval)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        interval = new_interval;
+    }
+    wake.notify_all();
+}
+
+std::vector<BackendHealth> HealthMonitor::status() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    std::vector<BackendHealth> result;
+    for (const auto &backend : backends)
+    {
+        result.push_back(backend.health);
+        if (backend.health.checked)
+        {
+            result.back().seconds_since_check = std::chrono::duration<double>(now - backend.checked_at).count();
+        }
+    }
+    return result;
+}
+
+bool HealthMonitor::healthy(const std::string &name) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &backend : backends)
+    {
+        if (backend.health.name == name)
+        {
+            return backend.health.healthy;
+        }
+    }
+    return false;
+}
+
+void HealthMonitor::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        check_requested = false;
+        for (size_t i = 0; i < backends.size(); ++i)
+        {
+            cpr::Url url{backends[i].health.url};
+            bool was_checked = backends[i].health.checked;
+            bool was_healthy = backends[i].health.healthy;
+
+            // Сеть опрашивается без блокировки: status() не ждёт медленный сервер.
+            lock.unlock();
+            auto start = std::chrono::steady_clock::now();
+            auto r = cpr::Get(url, cpr::Timeout{HEALTH_TIMEOUT_MS});
+            auto now = std::chrono::steady_clock::now();
+            lock.lock();
+
+            auto &health = backends[i].health;
+            health.checked = true;
+            health.status_code = r.status_code;
+            // Сервер, который ещё загружает модель, отвечает 503: он доступен, но не готов.
+            health.healthy = r.status_code == HEALTH_OK;
+            health.latency_ms = std::chrono::duration<double, std::milli>(now - start).count();
+            health.error = r.error.message;
+            backends[i].checked_at = now;
+            if (!was_checked || health.healthy != was_healthy)
+            {
+                std::cerr << "Backend " << health.name << (health.healthy ? " is available" : " is unavailable: ")
+                          << (health.error.empty() && !health.healthy ? "HTTP " + std::to_string(health.status_code)
+                                                                      : health.error)
+                          << std::endl;
+            }
+            if (stopping)
+            {
+                return;
+            }
+        }
+        wake.wait_for(lock, interval, [this]() { return stopping || check_requested; });
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "cpr/cprtypes.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Состояние сервера по результату последней проверки.
+ */
+struct BackendHealth
+{
+    std::string name;                  ///< Имя сервера ("model", "embedder").
+    std::string url;                   ///< Адрес проверки готовности (/health сервера).
+    bool checked = false;              ///< Была ли хотя бы одна проверка.
+    bool healthy = false;              ///< Сервер ответил на последнюю проверку кодом 200.
+    long status_code = 0;              ///< HTTP-код последнего ответа (0 - нет соединения).
+    double latency_ms = 0;             ///< Время ответа на последнюю проверку.
+    double seconds_since_check = -1;   ///< Давность последней проверки (-1 - проверок не было).
+    std::string error;                 ///< Ошибка соединения последней проверки.
+};
+
+/**
+ * @brief Фоновая проверка доступности серверов.
+ *
+ * Поток периодически запрашивает /health серверов по заданным адресам и сохраняет результат;
+ * сервер считается готовым только при ответе 200.
+ * Чтение состояния не ждёт сети: возвращается результат последней проверки.
+ */
+class HealthMonitor
+{
+    struct Backend
+    {
+        BackendHealth health;
+        std::chrono::steady_clock::time_point checked_at;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Backend> backends;
+    std::chrono::milliseconds interval;
+    bool stopping = false;
+    bool check_requested = false;
+    std::thread worker;
+
+public:
+    /**
+     * @param backends - пары (имя, адрес любого эндпоинта) проверяемых серверов
+     * @param interval - период проверок
+     */
+    HealthMonitor(std::vector<std::pair<std::string, cpr::Url>> backends, std::chrono::milliseconds interval);
+
+    HealthMonitor(const HealthMonitor &) = delete;
+    HealthMonitor &operator=(const HealthMonitor &) = delete;
+
+    /**
+     * @brief Останавливает фоновый поток.
+     */
+    ~HealthMonitor();
+
+    /**
+     * @brief Запуск фоновых проверок (первая проверка выполняется сразу).
+     */
+    void start();
+
+    /**
+     * @brief Внеочередная проверка всех серверов.
+     */
+    void checkNow();
+
+    /**
+     * @brief Период проверок.
+     */
+    void setInterval(std::chrono::milliseconds new_interval);
+
+    /**
+     * @brief Результаты последних проверок.
+     */
+    std::vector<BackendHealth> status() const;
+
+    /**
+     * @brief Ответил ли сервер на последнюю проверку.
+     *
+     * @param name - имя сервера
+     */
+    bool healthy(const std::string &name) const;
+
+private:
+    void run();
+};
@@ -0,0 +1,222 @@
+#include "hedged_request.hpp"
+#include "cpr/api.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <utility>
+
+// Минимальное количество замеров, после которого хеджирование начинает работать.
+#define HEDGE_MIN_SAMPLES 20
+// Нижняя граница задержки перед отправкой дубликата (мс).
+#define HEDGE_MIN_DELAY_MS 5.0
+// Потоков пула гонок: по два запроса на каждый одновременный интерактивный вопрос
+// с запасом на проигравшие запросы, которые ещё не завершились.
+#define HEDGE_POOL_THREADS 32
+
+LatencyTracker::LatencyTracker(size_t window) : samples(std::max<size_t>(window, 1), 0.0)
+{
+}
+
+void LatencyTracker::record(double ms)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    samples[next] = ms;
+    next = (next + 1) % samples.size();
+    filled = std::min(filled + 1, samples.size());
+}
+
+double LatencyTracker::percentile(double p) const
+{
+    std::vector<double> sorted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sorted.assign(samples.begin(), samples.begin() + filled);
+    }
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+
+    p = std::clamp(p, 0.0, 1.0);
+    auto nth = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + nth, sorted.end());
+    return sorted[nth];
+}
+
+size_t LatencyTracker::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return filled;
+}
+
+namespace
+{
+/**
+ * @brief Общее состояние основного и дублирующего запросов.
+ *
+ * Живёт в shared_ptr, поэтому проигравший запрос может завершиться
+ * уже после возврата из HedgedPoster::post.
+ */
+struct HedgeRace
+{
+    std::mutex mutex;
+    std::condition_variable done;
+    cpr::Response response;
+    bool has_winner = false;
+    int winner = -1;
+    int pending = 0;
+};
+
+/**
+ * @brief Запуск одного запроса гонки в пуле.
+ *
+ * @param latency - окно, в которое запрос записывает свою задержку (даже проиграв), или nullptr
+ * @param ticket - допуск дублирующего запроса, освобождаемый по его завершении, или nullptr
+ */
+void launch(ThreadPool &pool,
+            const std::shared_ptr<HedgeRace> &race,
+            int index,
+            cpr::Url url,
+            std::string body,
+            LatencyTracker *latency,
+            std::shared_ptr<RequestScheduler::Ticket> ticket)
+{
+    {
+        std::lock_guard<std::mutex> lock(race->mutex);
+        ++race->pending;
+    }
+    pool.submit(
+        [race, index, url = std::move(url), body = std::move(body), latency, ticket = std::move(ticket)]()
+        {
+            auto start = std::chrono::steady_clock::now();
+            cpr::Response r =
+                cpr::Post(url, cpr::Header{{"Content-Type", "application/json"}}, cpr::Body{body});
+            double elapsed_ms =
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (latency && r.status_code == 200)
+            {
+                latency->record(elapsed_ms);
+            }
+            if (ticket)
+            {
+                ticket->release(elapsed_ms, r.status_code == 200);
+            }
+
+            std::lock_guard<std::mutex> lock(race->mutex);
+            --race->pending;
+            if (race->has_winner)
+            {
+                return;
+            }
+            // Неуспешный ответ принимается только если больше ждать некого.
+            if (r.status_code == 200 || race->pending == 0)
+            {
+                race->response = std::move(r);
+                race->has_winner = true;
+                race->winner = index;
+            }
+            race->done.notify_all();
+        });
+}
+} // namespace
+
+HedgedPoster::HedgedPoster(std::vector<cpr::Url> replicas, RequestScheduler &scheduler)
+    : replicas(std::move(replicas)), scheduler(scheduler)
+{
+}
+
+cpr::Response HedgedPoster::post(const std::string &body, RequestPriority priority, bool single)
+{
+    cpr::Url primary;
+    {
+        std::lock_guard<std::mutex> lock(replicas_mutex);
+        primary = replicas.front();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&start]()
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto &latency = latencyOf(priority);
+    if (!single || priority != RequestPriority::interactive || !enabled || latency.size() < HEDGE_MIN_SAMPLES)
+    {
+        cpr::Response r = cpr::Post(primary, cpr::Header{{"Content-Type", "application/json"}}, cpr::Body{body});
+        if (single && r.status_code == 200)
+        {
+            latency.record(elapsed_ms());
+        }
+        return r;
+    }
+
+    std::call_once(pool_created, [this]() { pool = std::make_unique<ThreadPool>(HEDGE_POOL_THREADS); });
+    auto delay = std::max(latency.percentile(hedge_percentile), HEDGE_MIN_DELAY_MS);
+    auto race = std::make_shared<HedgeRace>();
+    // Задержку записывает основной запрос, даже если дубликат ответит раньше: иначе
+    // окно видело бы только быстрые ответы и порог хеджирования со временем занижался.
+    launch(*pool, race, 0, primary, body, &latency, nullptr);
+
+    std::unique_lock<std::mutex> lock(race->mutex);
+    if (!race->done.wait_for(lock,
+                             std::chrono::duration<double, std::milli>(delay),
+                             [&race]() { return race->has_winner; }))
+    {
+        lock.unlock();
+        // Дубликат - такая же нагрузка на сервер: без свободного слота он только усилил бы очередь.
+        if (auto ticket = scheduler.tryAdmit(priority))
+        {
+            ++hedges_issued;
+            launch(*pool,
+                   race,
+                   1,
+                   pickHedgeReplica(),
+                   body,
+                   nullptr,
+                   std::make_shared<RequestScheduler::Ticket>(std::move(*ticket)));
+        }
+        lock.lock();
+        race->done.wait(lock, [&race]() { return race->has_winner; });
+    }
+
+    if (race->winner == 1)
+    {
+        ++hedges_won;
+    }
+    return race->response;
+}
+
+void HedgedPoster::setHedging(bool enabled, double percentile)
+{
+    this->enabled = enabled;
+    this->hedge_percentile = std::clamp(percentile, 0.0, 1.0);
+}
+
+void HedgedPoster::setReplicas(std::vector<cpr::Url> replicas)
+{
+    if (replicas.empty())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(replicas_mutex);
+    this->replicas = std::move(replicas);
+}
+
+HedgeStats HedgedPoster::stats() const
+{
+    return {hedges_issued.load(), hedges_won.load()};
+}
+
+cpr::Url HedgedPoster::pickHedgeReplica() const
+{
+    std::lock_guard<std::mutex> lock(replicas_mutex);
+    // При единственной реплике дубликат уходит на неё же: llama-server
+    // обработает его в другом слоте.
+    return replicas.size() > 1 ? replicas[1] : replicas.front();
+}
+
+LatencyTracker &HedgedPoster::latencyOf(RequestPriority priority)
+{
+    return latency[static_cast<size_t>(priority)];
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include "cpr/cprtypes.h"
+#include "request_scheduler.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Скользящее окно последних задержек запросов.
+ *
+ * Хранит фиксированное количество последних замеров и позволяет получить
+ * произвольный перцентиль распределения.
+ */
+class LatencyTracker
+{
+    mutable std::mutex mutex;
+    std::vector<double> samples; ///< Кольцевой буфер замеров (мс).
+    size_t next = 0;             ///< Позиция для следующей записи.
+    size_t filled = 0;           ///< Количество заполненных ячеек.
+
+public:
+    /**
+     * @param window - размер окна (количество последних замеров)
+     */
+    explicit LatencyTracker(size_t window = 256);
+
+    /**
+     * @brief Добавляет замер задержки.
+     *
+     * @param ms - задержка в миллисекундах
+     */
+    void record(double ms);
+
+    /**
+     * @brief Возвращает перцентиль задержки по текущему окну.
+     *
+     * @param p - перцентиль в диапазоне [0, 1]
+     * @return double - задержка в миллисекундах, 0 если замеров нет
+     */
+    double percentile(double p) const;
+
+    /**
+     * @brief Количество замеров в окне.
+     */
+    size_t size() const;
+};
+
+/**
+ * @brief Счётчики хеджированных запросов.
+ */
+struct HedgeStats
+{
+    uint64_t issued = 0; ///< Сколько дублирующих запросов было отправлено.
+    uint64_t won = 0;    ///< Сколько раз дублирующий запрос ответил первым.
+};
+
+/**
+ * @brief Отправка POST-запросов с хеджированием.
+ *
+ * Если ответ на первый интерактивный запрос не пришёл за время, равное заданному
+ * перцентилю недавних интерактивных задержек, тот же запрос отправляется на следующую
+ * реплику. Возвращается первый успешный ответ. Задержки учитываются отдельно для каждого
+ * класса приоритета, чтобы индексация не сдвигала порог хеджирования вопросов.
+ * Дубликат занимает свой слот планировщика и не отправляется, если слота нет.
+ * Запросы гонки выполняются в собственном пуле потоков, который создаётся при первой гонке.
+ */
+class HedgedPoster
+{
+    mutable std::mutex replicas_mutex;
+    std::vector<cpr::Url> replicas;
+
+    LatencyTracker latency[RequestScheduler::n_classes]; ///< Окна задержек по классам приоритета.
+    std::atomic<bool> enabled{false};
+    std::atomic<double> hedge_percentile{0.95};
+    std::atomic<uint64_t> hedges_issued{0};
+    std::atomic<uint64_t> hedges_won{0};
+    RequestScheduler &scheduler; ///< Допуск дублирующих запросов.
+
+    /**
+     * @brief Потоки основного и дублирующего запросов гонки.
+     *
+     * Объявлен последним: при уничтожении дожидается проигравших запросов раньше остальных полей.
+     */
+    std::once_flag pool_created;
+    std::unique_ptr<ThreadPool> pool;
+
+public:
+    /**
+     * @param replicas - адреса реплик, первая считается основной
+     * @param scheduler - планировщик, через который допускаются дублирующие запросы
+     */
+    HedgedPoster(std::vector<cpr::Url> replicas, RequestScheduler &scheduler);
+
+    /**
+     * @brief Отправляет JSON-тело на одну из реплик.
+     *
+     * @param body - тело запроса
+     * @param priority - класс приоритета; хеджируются только интерактивные запросы
+     * @param single - одиночный запрос: его задержка учитывается в окне класса, и его можно хеджировать
+     *                 (пакетные запросы отвечают заметно дольше и исказили бы перцентиль)
+     * @return cpr::Response - первый успешный ответ (или последний неуспешный)
+     */
+    cpr::Response post(const std::string &body, RequestPriority priority, bool single = true);
+
+    /**
+     * @brief Включение/выключение хеджирования.
+     *
+     * @param enabled - включить хеджирование
+     * @param percentile - перцентиль недавних задержек, после которого отправляется дубликат
+     */
+    void setHedging(bool enabled, double percentile);
+
+    /**
+     * @brief Замена списка реплик.
+     *
+     * @param replicas - адреса реплик, первая считается основной
+     */
+    void setReplicas(std::vector<cpr::Url> replicas);
+
+    /**
+     * @brief Текущие значения счётчиков хеджирования.
+     */
+    HedgeStats stats() const;
+
+private:
+    /**
+     * @brief Выбор реплики для дублирующего запроса.
+     */
+    cpr::Url pickHedgeReplica() const;
+
+    /**
+     * @brief Окно задержек класса приоритета.
+     */
+    LatencyTracker &latencyOf(RequestPriority priority);
+};
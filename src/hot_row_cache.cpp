@@ -0,0 +1,67 @@
+#include "hot_row_cache.hpp"
+#include <algorithm>
+
+/// Сколько раз строка должна стать кандидатом, чтобы попасть в кэш.
+#define HOT_ROW_MIN_HITS 2
+/// Во сколько раз счётчиков обращений может быть больше ёмкости кэша до их сброса.
+#define HOT_ROW_HITS_FACTOR 4
+
+HotRowCache::HotRowCache(size_t capacity, size_t dimension) : capacity(capacity), dimension(dimension)
+{
+}
+
+bool HotRowCache::find(uint64_t id, float *vector)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(id);
+    if (it == entries.end())
+    {
+        return false;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    std::copy(it->second->vector.begin(), it->second->vector.end(), vector);
+    return true;
+}
+
+void HotRowCache::hit(uint64_t id, const float *vector)
+{
+    if (capacity == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.count(id))
+    {
+        return;
+    }
+    // Счётчики сбрасываются целиком: редкие строки не накапливаются, а горячие быстро набирают обращения снова.
+    if (hits.size() >= capacity * HOT_ROW_HITS_FACTOR)
+    {
+        hits.clear();
+    }
+    if (++hits[id] < HOT_ROW_MIN_HITS)
+    {
+        return;
+    }
+    hits.erase(id);
+
+    lru.push_front({id, std::vector<float>(vector, vector + dimension)});
+    entries[id] = lru.begin();
+    if (lru.size() > capacity)
+    {
+        entries.erase(lru.back().id);
+        lru.pop_back();
+    }
+}
+
+size_t HotRowCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return lru.size();
+}
+
+size_t HotRowCache::memoryUsage() const
+{
+    return size() * dimension * sizeof(float);
+}
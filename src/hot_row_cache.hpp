@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Кэш полных векторов часто находимых строк.
+ *
+ * Строка попадает в кэш, когда становится кандидатом повторно: разовые кандидаты не
+ * вытесняют горячие строки. При переполнении вытесняются давно не использованные строки.
+ * Ключ - ID записи: вектор записи после добавления не меняется.
+ */
+class HotRowCache
+{
+    struct Entry
+    {
+        uint64_t id;
+        std::vector<float> vector;
+    };
+
+    size_t capacity;                                                ///< Наибольшее количество строк.
+    size_t dimension;                                               ///< Размерность векторов.
+    std::list<Entry> lru;                                           ///< Начало - недавно использованные.
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+    std::unordered_map<uint64_t, uint32_t> hits;                    ///< Обращения к строкам вне кэша.
+    mutable std::mutex mutex;
+
+public:
+    /**
+     * @param capacity - наибольшее количество строк (0 - кэш не используется)
+     * @param dimension - размерность векторов
+     */
+    HotRowCache(size_t capacity, size_t dimension);
+
+    /**
+     * @brief Скопировать вектор строки из кэша.
+     *
+     * @param id - ID записи
+     * @param vector - сюда копируется dimension значений
+     * @return true, если строка есть в кэше
+     */
+    bool find(uint64_t id, float *vector);
+
+    /**
+     * @brief Учесть обращение к строке вне кэша; часто находимая строка копируется в кэш.
+     *
+     * @param id - ID записи
+     * @param vector - полный вектор строки
+     */
+    void hit(uint64_t id, const float *vector);
+
+    /**
+     * @brief Количество строк в кэше.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Объём векторов в кэше в байтах.
+     */
+    size_t memoryUsage() const;
+};
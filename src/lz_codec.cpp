@@ -0,0 +1,181 @@
+#include "lz_codec.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/// Минимальная длина совпадения.
+#define LZ_MIN_MATCH 4
+/// Наибольшее смещение совпадения (2 байта).
+#define LZ_MAX_OFFSET 65535
+/// Размер хеш-таблицы поиска совпадений (log2).
+#define LZ_HASH_BITS 12
+/// Последние байты блока всегда записываются литералами.
+#define LZ_LAST_LITERALS 5
+
+namespace
+{
+uint32_t read32(const char *data)
+{
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t hashSequence(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+void writeLength(std::string &output, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        output.push_back(static_cast<char>(255));
+    }
+    output.push_back(static_cast<char>(length));
+}
+
+void writeSequence(std::string &output, const char *literals, size_t literal_length, size_t offset, size_t match_length)
+{
+    size_t match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+    output.push_back(static_cast<char>((std::min<size_t>(literal_length, 15) << 4) | std::min<size_t>(match_code, 15)));
+    if (literal_length >= 15)
+    {
+        writeLength(output, literal_length - 15);
+    }
+    output.append(literals, literal_length);
+    if (match_length == 0)
+    {
+        return;
+    }
+    output.push_back(static_cast<char>(offset & 0xFF));
+    output.push_back(static_cast<char>(offset >> 8));
+    if (match_code >= 15)
+    {
+        writeLength(output, match_code - 15);
+    }
+}
+
+/**
+ * @brief Чтение продолжения длины.
+ *
+ * @return false, если данные закончились
+ */
+bool readLength(const unsigned char *&input, const unsigned char *end, size_t &length)
+{
+    unsigned char byte;
+    do
+    {
+        if (input == end)
+        {
+            return false;
+        }
+        byte = *input++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+} // namespace
+
+namespace lz
+{
+size_t compress(std::string_view input, std::string &output)
+{
+    size_t start = output.size();
+    const char *data = input.data();
+    size_t size = input.size();
+    std::vector<uint32_t> table(size_t(1) << LZ_HASH_BITS, 0); // Позиция + 1; 0 - пусто.
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    size_t match_limit = size > LZ_LAST_LITERALS ? size - LZ_LAST_LITERALS : 0;
+    while (pos + LZ_MIN_MATCH <= match_limit)
+    {
+        uint32_t sequence = read32(data + pos);
+        uint32_t &slot = table[hashSequence(sequence)];
+        size_t candidate = slot;
+        slot = static_cast<uint32_t>(pos + 1);
+        if (candidate == 0 || pos + 1 - candidate > LZ_MAX_OFFSET || read32(data + candidate - 1) != sequence)
+        {
+            ++pos;
+            continue;
+        }
+
+        --candidate;
+        size_t length = LZ_MIN_MATCH;
+        while (pos + length < match_limit && data[candidate + length] == data[pos + length])
+        {
+            ++length;
+        }
+        writeSequence(output, data + anchor, pos - anchor, pos - candidate, length);
+        pos += length;
+        anchor = pos;
+    }
+    writeSequence(output, data + anchor, size - anchor, 0, 0);
+    return output.size() - start;
+}
+
+bool decompress(const char *input, size_t size, char *output, size_t output_size)
+{
+    auto in = reinterpret_cast<const unsigned char *>(input);
+    auto in_end = in + size;
+    char *out = output;
+    char *out_end = output + output_size;
+
+    while (in < in_end)
+    {
+        unsigned token = *in++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !readLength(in, in_end, literal_length))
+        {
+            return false;
+        }
+        if (literal_length > static_cast<size_t>(in_end - in) || literal_length > static_cast<size_t>(out_end - out))
+        {
+            return false;
+        }
+        std::memcpy(out, in, literal_length);
+        in += literal_length;
+        out += literal_length;
+        if (in == in_end)
+        {
+            break;
+        }
+
+        if (in_end - in < 2)
+        {
+            return false;
+        }
+        size_t offset = in[0] | (size_t(in[1]) << 8);
+        in += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !readLength(in, in_end, match_length))
+        {
+            return false;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > static_cast<size_t>(out - output) ||
+            match_length > static_cast<size_t>(out_end - out))
+        {
+            return false;
+        }
+
+        const char *match = out - offset;
+        if (offset >= match_length)
+        {
+            std::memcpy(out, match, match_length);
+            out += match_length;
+        }
+        else
+        {
+            // Перекрывающееся совпадение повторяет последние offset байт.
+            for (size_t i = 0; i < match_length; ++i)
+            {
+                *out++ = match[i];
+            }
+        }
+    }
+    return out == out_end;
+}
+} // namespace lz
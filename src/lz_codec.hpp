@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Быстрое сжатие блоков семейства LZ77 (формат последовательностей в духе LZ4).
+ *
+ * Последовательность: байт-токен (старшие 4 бита - длина литералов, младшие - длина
+ * совпадения минус 4), продолжение длин байтами 255, литералы, смещение совпадения
+ * (2 байта, little-endian) и продолжение длины совпадения. Последняя последовательность
+ * содержит только литералы. Блок распаковывается независимо от других блоков.
+ */
+namespace lz
+{
+/**
+ * @brief Сжать блок.
+ *
+ * @param input - исходные данные
+ * @param output - сюда дописываются сжатые данные
+ * @return size_t - размер сжатых данных
+ */
+size_t compress(std::string_view input, std::string &output);
+
+/**
+ * @brief Распаковать блок.
+ *
+ * Повреждённые данные не приводят к выходу за границы буферов.
+ *
+ * @param input - сжатые данные
+ * @param size - размер сжатых данных
+ * @param output - буфер распакованных данных
+ * @param output_size - точный размер распакованных данных
+ * @return true, если блок распакован и его размер совпал с output_size
+ */
+bool decompress(const char *input, size_t size, char *output, size_t output_size);
+} // namespace lz
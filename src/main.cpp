@@ -1,11 +1,19 @@
 #include "rag.hpp"
+#include "thread_pool.hpp"
 #include "vector_db.hpp"
+#include <algorithm>
 #include <cpr/cpr.h>
 #include <exception>
 #include <iostream>
+#include <memory>
+#include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #define VERSION "1.0\n"
@@ -102,6 +110,87 @@ const string DB_STATE[] = {"ON", "OFF"};
 //     }
 // }
 
+namespace
+{
+/**
+ * @brief Пул потоков для асинхронных методов.
+ *
+ * Создаётся один раз и не уничтожается: при выходе из интерпретатора его потоки
+ * не должны пытаться захватить GIL.
+ */
+ThreadPool &asyncPool()
+{
+    static auto *pool = new ThreadPool(std::max(4u, std::thread::hardware_concurrency()));
+    return *pool;
+}
+
+/**
+ * @brief Выполнить fn в пуле потоков без GIL.
+ *
+ * @return concurrent.futures.Future, совместимый с asyncio.wrap_future
+ */
+template <typename F>
+pybind11::object submitAsync(F fn)
+{
+    auto future = pybind11::module_::import("concurrent.futures").attr("Future")();
+    auto state = std::make_shared<pybind11::object>(future);
+
+    asyncPool().submit(
+        [fn = std::move(fn), state]() mutable
+        {
+            try
+            {
+                if constexpr (std::is_void_v<decltype(fn())>)
+                {
+                    fn();
+                    pybind11::gil_scoped_acquire acquire;
+                    state->attr("set_result")(pybind11::none());
+                }
+                else
+                {
+                    auto result = fn();
+                    pybind11::gil_scoped_acquire acquire;
+                    state->attr("set_result")(std::move(result));
+                }
+            }
+            catch (const std::exception &e)
+            {
+                pybind11::gil_scoped_acquire acquire;
+                state->attr("set_exception")(pybind11::module_::import("builtins").attr("RuntimeError")(e.what()));
+            }
+            catch (...)
+            {
+                // Иначе исключение осталось бы в отброшенном future пула, а Future Python не завершился бы.
+                pybind11::gil_scoped_acquire acquire;
+                state->attr("set_exception")(
+                    pybind11::module_::import("builtins").attr("RuntimeError")("Unknown C++ exception"));
+            }
+            // Последняя ссылка на Python-объект должна освобождаться под GIL.
+            pybind11::gil_scoped_acquire acquire;
+            state.reset();
+        });
+    return future;
+}
+
+/**
+ * @brief Представление строк снимка как NumPy-массива только для чтения, без копирования.
+ *
+ * Снимок живёт, пока жив массив, и не меняется при дальнейших добавлениях.
+ */
+pybind11::array_t<float> snapshotView(std::shared_ptr<const VectorSnapshot> snapshot,
+                                      const float *data,
+                                      pybind11::ssize_t rows,
+                                      pybind11::ssize_t cols)
+{
+    pybind11::capsule owner(new std::shared_ptr<const VectorSnapshot>(std::move(snapshot)),
+                            [](void *p) { delete static_cast<std::shared_ptr<const VectorSnapshot> *>(p); });
+    pybind11::array_t<float> view(
+        {rows, cols}, {cols * static_cast<pybind11::ssize_t>(sizeof(float)), sizeof(float)}, data, owner);
+    view.attr("setflags")(pybind11::arg("write") = false);
+    return view;
+}
+} // namespace
+
 PYBIND11_MODULE(myapp, m)
 {
     m.doc() = "The given library implements RAG (Retrieval-Augmented Generation) and allows communication with LLM "
@@ -111,13 +200,360 @@ PYBIND11_MODULE(myapp, m)
         .value("paragraphs", generatorType::paragraphs)
         .export_values();
 
-    pybind11::class_<Rag>(m, "Rag")
+    pybind11::enum_<RequestPriority>(m, "RequestPriority")
+        .value("interactive", RequestPriority::interactive)
+        .value("background", RequestPriority::background);
+
+    pybind11::class_<PriorityClassStats>(m, "PriorityClassStats")
+        .def_readonly("in_flight", &PriorityClassStats::in_flight)
+        .def_readonly("waiting", &PriorityClassStats::waiting)
+        .def_readonly("admitted", &PriorityClassStats::admitted);
+
+    pybind11::class_<HedgeStats>(m, "HedgeStats")
+        .def_readonly("issued", &HedgeStats::issued)
+        .def_readonly("won", &HedgeStats::won);
+
+    pybind11::class_<LimiterStats>(m, "LimiterStats")
+        .def_readonly("limit", &LimiterStats::limit)
+        .def_readonly("in_flight", &LimiterStats::in_flight)
+        .def_readonly("min_rtt_ms", &LimiterStats::min_rtt_ms);
+
+    pybind11::class_<DatabaseEntry>(m, "DatabaseEntry")
+        .def_readonly("id", &DatabaseEntry::id)
+        .def_readonly("name", &DatabaseEntry::name)
+        .def_readonly("database", &DatabaseEntry::database);
+
+    pybind11::class_<BackendHealth>(m, "BackendHealth")
+        .def_readonly("name", &BackendHealth::name)
+        .def_readonly("url", &BackendHealth::url)
+        .def_readonly("checked", &BackendHealth::checked)
+        .def_readonly("healthy", &BackendHealth::healthy)
+        .def_readonly("status_code", &BackendHealth::status_code)
+        .def_readonly("latency_ms", &BackendHealth::latency_ms)
+        .def_readonly("seconds_since_check", &BackendHealth::seconds_since_check)
+        .def_readonly("error", &BackendHealth::error);
+
+    pybind11::class_<SourceDocument>(m, "SourceDocument")
+        .def_readonly("id", &SourceDocument::id)
+        .def_readonly("path", &SourceDocument::path)
+        .def_readonly("size", &SourceDocument::size)
+        .def_readonly("hash", &SourceDocument::hash)
+        .def_readonly("stale", &SourceDocument::stale);
+
+    pybind11::class_<MappingOptions>(m, "MappingOptions")
         .def(pybind11::init<>())
-        .def("createDatabase", &Rag::createDatabase)
-        .def("request", &Rag::request)
-        .def("get_vector_database_list", &Rag::get_vector_database_list);
+        .def_readwrite("enabled", &MappingOptions::enabled)
+        .def_readwrite("populate", &MappingOptions::populate)
+        .def_readwrite("huge_pages", &MappingOptions::huge_pages)
+        .def_readwrite("lock", &MappingOptions::lock)
+        .def_readwrite("warm_up", &MappingOptions::warm_up)
+        .def_readwrite("tiered", &MappingOptions::tiered)
+        .def_readwrite("hot_rows", &MappingOptions::hot_rows);
 
-    pybind11::class_<VectorDatabase>(m, "VectorDatabase")
+    pybind11::class_<MemoryOptions>(m, "MemoryOptions")
+        .def(pybind11::init<>())
+        .def_readwrite("huge_pages", &MemoryOptions::huge_pages)
+        .def_readwrite("numa", &MemoryOptions::numa);
+
+    pybind11::class_<DatabaseResidency>(m, "DatabaseResidency")
+        .def_readonly("id", &DatabaseResidency::id)
+        .def_readonly("name", &DatabaseResidency::name)
+        .def_readonly("resident", &DatabaseResidency::resident)
+        .def_readonly("memory_bytes", &DatabaseResidency::memory_bytes)
+        .def_readonly("vectors", &DatabaseResidency::vectors)
+        .def_readonly("load_progress", &DatabaseResidency::load_progress);
+
+    pybind11::class_<Rag>(m, "Rag")
+        .def(pybind11::init<int>(), pybind11::arg("dim") = 0)
+        .def("createDatabase", &Rag::createDatabase, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def(
+            "create_database_async",
+            [](Rag &rag, std::string filename, std::vector<std::string> files, generatorType type)
+            {
+                return submitAsync([&rag, filename = std::move(filename), files = std::move(files), type]()
+                                   { return rag.createDatabase(filename, files, type); });
+            },
+            pybind11::arg("filename"),
+            pybind11::arg("files"),
+            pybind11::arg("type"),
+            pybind11::keep_alive<0, 1>())
+        .def("request",
+             &Rag::request,
+             pybind11::call_guard<pybind11::gil_scoped_release>(),
+             pybind11::arg("question"),
+             pybind11::arg("database_id_list"),
+             pybind11::arg("n_predict") = 500,
+             pybind11::arg("temperature") = 0.5f,
+             pybind11::arg("top_k") = 1,
+             pybind11::arg("rag_k") = 3,
+             pybind11::arg("rag_sim_threshold") = 0.3f,
+             pybind11::arg("id_slot") = -1)
+        .def(
+            "requestStream",
+            [](Rag &rag,
+               std::string question,
+               std::vector<int> database_id_list,
+               pybind11::function on_token,
+               int n_predict,
+               float temperature,
+               int top_k,
+               int rag_k,
+               float rag_sim_threshold,
+               int id_slot)
+            {
+                // GIL отпускается на время запроса и берётся только для вызова on_token.
+                pybind11::gil_scoped_release release;
+                return rag.requestStream(
+                    std::move(question),
+                    std::move(database_id_list),
+                    [&on_token](const std::string &token)
+                    {
+                        pybind11::gil_scoped_acquire acquire;
+                        on_token(token);
+                    },
+                    n_predict,
+                    temperature,
+                    top_k,
+                    rag_k,
+                    rag_sim_threshold,
+                    id_slot);
+            },
+            pybind11::arg("question"),
+            pybind11::arg("database_id_list"),
+            pybind11::arg("on_token"),
+            pybind11::arg("n_predict") = 500,
+            pybind11::arg("temperature") = 0.5f,
+            pybind11::arg("top_k") = 1,
+            pybind11::arg("rag_k") = 3,
+            pybind11::arg("rag_sim_threshold") = 0.3f,
+            pybind11::arg("id_slot") = -1)
+        .def(
+            "request_async",
+            [](Rag &rag,
+               std::string question,
+               std::vector<int> database_id_list,
+               int n_predict,
+               float temperature,
+               int top_k,
+               int rag_k,
+               float rag_sim_threshold,
+               int id_slot)
+            {
+                return submitAsync(
+                    [=, &rag]()
+                    {
+                        return rag.request(
+                            question, database_id_list, n_predict, temperature, top_k, rag_k, rag_sim_threshold, id_slot);
+                    });
+            },
+            pybind11::arg("question"),
+            pybind11::arg("database_id_list"),
+            pybind11::arg("n_predict") = 500,
+            pybind11::arg("temperature") = 0.5f,
+            pybind11::arg("top_k") = 1,
+            pybind11::arg("rag_k") = 3,
+            pybind11::arg("rag_sim_threshold") = 0.3f,
+            pybind11::arg("id_slot") = -1,
+            pybind11::keep_alive<0, 1>())
+        .def("get_vector_database_list", &Rag::get_vector_database_list)
+        .def("listDatabases", &Rag::listDatabases)
+        .def("getDatabase", &Rag::getDatabase, pybind11::arg("database_id"))
+        .def("findDatabaseId", &Rag::findDatabaseId, pybind11::arg("name"))
+        .def("getDatabaseResidency", &Rag::getDatabaseResidency)
+        .def("setDatabaseMemoryBudget",
+             &Rag::setDatabaseMemoryBudget,
+             pybind11::arg("bytes"),
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("getDatabaseMemoryBudget", &Rag::getDatabaseMemoryBudget)
+        .def("preloadDatabases", &Rag::preloadDatabases)
+        .def("databasesReady", &Rag::databasesReady)
+        .def("setMappingOptions", &Rag::setMappingOptions, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("getMappingOptions", &Rag::getMappingOptions)
+        .def("setMemoryOptions", &Rag::setMemoryOptions)
+        .def("getMemoryOptions", &Rag::getMemoryOptions)
+        .def("pinDatabase",
+             &Rag::pinDatabase,
+             pybind11::arg("database_id"),
+             pybind11::arg("pinned") = true,
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("compressDatabase",
+             &Rag::compressDatabase,
+             pybind11::arg("database_id"),
+             pybind11::arg("enabled") = true,
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("warmUpDatabase",
+             &Rag::warmUpDatabase,
+             pybind11::arg("database_id"),
+             pybind11::arg("wait") = false,
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("getBackendHealth", &Rag::getBackendHealth)
+        .def("backendsHealthy", &Rag::backendsHealthy)
+        .def("checkBackends", &Rag::checkBackends)
+        .def("getDimension", &Rag::getDimension)
+        .def("waitDatabasesReady",
+             &Rag::waitDatabasesReady,
+             pybind11::arg("timeout_seconds") = -1,
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("setHedging", &Rag::setHedging, pybind11::arg("enabled"), pybind11::arg("percentile") = 0.95)
+        .def("setEmbedderReplicas", &Rag::setEmbedderReplicas)
+        .def("getHedgeStats", &Rag::getHedgeStats)
+        .def("getEmbedderLimiterStats", &Rag::getEmbedderLimiterStats)
+        .def("getModelLimiterStats", &Rag::getModelLimiterStats)
+        .def("setPriorityLimits", &Rag::setPriorityLimits)
+        .def("getEmbedderSchedulerStats", &Rag::getEmbedderSchedulerStats)
+        .def("getModelSchedulerStats", &Rag::getModelSchedulerStats)
+        .def("getCoalescedEmbeddings", &Rag::getCoalescedEmbeddings)
+        .def("setContextTokenBudget", &Rag::setContextTokenBudget)
+        .def("setContextCompression",
+             &Rag::setContextCompression,
+             pybind11::arg("enabled"),
+             pybind11::arg("token_budget") = 512)
+        .def("setSourceReferences", &Rag::setSourceReferences)
+        .def("getSourceReferences", &Rag::getSourceReferences)
+        .def("checkSources", &Rag::checkSources, pybind11::call_guard<pybind11::gil_scoped_release>());
+
+    using FloatMatrix = pybind11::array_t<float, pybind11::array::c_style | pybind11::array::forcecast>;
+
+    pybind11::class_<VectorDatabase, std::shared_ptr<VectorDatabase>>(m, "VectorDatabase")
         .def(pybind11::init<const string &, size_t>())
-        .def("getFilename", &VectorDatabase::getFilename);
+        // Поиск идёт по снимку без блокировок, поэтому GIL на время вызовов в C++ отпускается.
+        .def("initialize", &VectorDatabase::initialize, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("save", &VectorDatabase::save, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("size", &VectorDatabase::size)
+        .def("attach", &VectorDatabase::attach)
+        .def("unload", &VectorDatabase::unload, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("isResident", &VectorDatabase::isResident)
+        .def("memoryUsage", &VectorDatabase::memoryUsage)
+        .def("loadProgress", &VectorDatabase::loadProgress)
+        .def("setMappingOptions", &VectorDatabase::setMappingOptions)
+        .def("getMappingOptions", &VectorDatabase::getMappingOptions)
+        .def("setMemoryOptions", &VectorDatabase::setMemoryOptions)
+        .def("getMemoryOptions", &VectorDatabase::getMemoryOptions)
+        .def("warmUp",
+             &VectorDatabase::warmUp,
+             pybind11::arg("wait") = false,
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("setLocked", &VectorDatabase::setLocked, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("isMapped", &VectorDatabase::isMapped)
+        .def("setEmbeddingCompression",
+             &VectorDatabase::setEmbeddingCompression,
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("getEmbeddingCompression", &VectorDatabase::getEmbeddingCompression)
+        .def("getDimension", &VectorDatabase::getDimension)
+        .def("getFilename", &VectorDatabase::getFilename)
+        .def("getMetadata",
+             pybind11::overload_cast<uint64_t>(&VectorDatabase::getMetadata, pybind11::const_),
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("findTopK",
+             pybind11::overload_cast<const std::vector<float> &, uint32_t, float>(&VectorDatabase::findTopK,
+                                                                                    pybind11::const_),
+             pybind11::arg("query"),
+             pybind11::arg("k") = 5,
+             pybind11::arg("similarity_threshold") = 0.0f,
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("remove",
+             &VectorDatabase::remove,
+             pybind11::arg("id"),
+             pybind11::call_guard<pybind11::gil_scoped_release>())
+        // Условие - функция Python, поэтому removeWhere выполняется с GIL.
+        .def("removeWhere", &VectorDatabase::removeWhere, pybind11::arg("filter"))
+        .def("compact", &VectorDatabase::compact, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("setCompactionThreshold", &VectorDatabase::setCompactionThreshold, pybind11::arg("ratio"))
+        .def(
+            "add_batch",
+            [](VectorDatabase &db, FloatMatrix data, const std::vector<string> &metadata)
+            {
+                if (data.ndim() != 2 || static_cast<size_t>(data.shape(1)) != db.getDimension())
+                {
+                    throw std::invalid_argument("Expected float32 array of shape (n, " +
+                                                std::to_string(db.getDimension()) + ")");
+                }
+                if (!metadata.empty() && metadata.size() != static_cast<size_t>(data.shape(0)))
+                {
+                    throw std::invalid_argument("Expected " + std::to_string(data.shape(0)) +
+                                                " metadata strings, got " + std::to_string(metadata.size()));
+                }
+                // Строки копируются из буфера NumPy прямо в сегменты БД; массив data жив до конца вызова.
+                std::vector<uint64_t> ids;
+                {
+                    pybind11::gil_scoped_release release;
+                    ids = db.addEmbeddings(data.data(), static_cast<size_t>(data.shape(0)), metadata);
+                }
+                return pybind11::array_t<uint64_t>(static_cast<pybind11::ssize_t>(ids.size()), ids.data());
+            },
+            pybind11::arg("data"),
+            pybind11::arg("metadata") = std::vector<string>{})
+        .def(
+            "search_batch",
+            [](const VectorDatabase &db, FloatMatrix queries, uint32_t k, float similarity_threshold)
+            {
+                if (queries.ndim() != 2 || static_cast<size_t>(queries.shape(1)) != db.getDimension())
+                {
+                    throw std::invalid_argument("Expected float32 array of shape (q, " +
+                                                std::to_string(db.getDimension()) + ")");
+                }
+                auto n_queries = queries.shape(0);
+                pybind11::array_t<uint64_t> ids({n_queries, static_cast<pybind11::ssize_t>(k)});
+                pybind11::array_t<float> scores({n_queries, static_cast<pybind11::ssize_t>(k)});
+                auto *ids_data = ids.mutable_data();
+                auto *scores_data = scores.mutable_data();
+                {
+                    pybind11::gil_scoped_release release;
+                    db.findTopKBatch(
+                        queries.data(), static_cast<size_t>(n_queries), k, similarity_threshold, ids_data, scores_data);
+                }
+                return pybind11::make_tuple(ids, scores);
+            },
+            pybind11::arg("queries"),
+            pybind11::arg("k") = 5,
+            pybind11::arg("similarity_threshold") = 0.0f)
+        .def(
+            "embeddings",
+            [](const VectorDatabase &db, bool copy)
+            {
+                // Матрица текущего снимка, включая удалённые, но не вычищенные строки. Пока строки
+                // помещаются в один сегмент, возвращается представление без копирования. Строки
+                // нескольких сегментов не лежат подряд: их копия создаётся только по явному copy=True,
+                // а без копирования доступны через embedding_segments.
+                auto snapshot = db.snapshot();
+                auto rows = static_cast<pybind11::ssize_t>(snapshot->rows);
+                auto cols = static_cast<pybind11::ssize_t>(db.getDimension());
+                if (snapshot->segments.size() > 1 || copy)
+                {
+                    if (!copy)
+                    {
+                        throw std::invalid_argument("Embeddings span " + std::to_string(snapshot->segments.size()) +
+                                                    " segments; use embedding_segments() or embeddings(copy=True)");
+                    }
+                    pybind11::array_t<float> result({rows, cols});
+                    auto *out = result.mutable_data();
+                    for (size_t row = 0; row < snapshot->rows; ++row)
+                    {
+                        const auto *src = snapshot->segment(row).embeddings.get() +
+                                          row % VectorSnapshot::segment_rows * db.getDimension();
+                        std::copy(src, src + db.getDimension(), out + row * db.getDimension());
+                    }
+                    return result;
+                }
+
+                const float *data = snapshot->segments.empty() ? nullptr : snapshot->segments[0]->embeddings.get();
+                return snapshotView(std::move(snapshot), data, rows, cols);
+            },
+            pybind11::arg("copy") = false)
+        .def("embedding_segments",
+             [](const VectorDatabase &db)
+             {
+                 // Представления сегментов без копирования по порядку строк; каждое держит снимок.
+                 auto snapshot = db.snapshot();
+                 auto cols = static_cast<pybind11::ssize_t>(db.getDimension());
+                 pybind11::list segments;
+                 for (size_t first = 0; first < snapshot->rows; first += VectorSnapshot::segment_rows)
+                 {
+                     auto rows = static_cast<pybind11::ssize_t>(
+                         std::min(VectorSnapshot::segment_rows, snapshot->rows - first));
+                     const float *data = snapshot->segment(first).embeddings.get();
+                     segments.append(snapshotView(snapshot, data, rows, cols));
+                 }
+                 return segments;
+             });
 }
@@ -0,0 +1,192 @@
+#include "memory_placement.hpp"
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// Размер огромной страницы.
+#define HUGE_PAGE_SIZE (2u << 20)
+/// Политика mbind: предпочитать узел, при нехватке памяти брать с других (MPOL_PREFERRED).
+#define MPOL_PREFERRED_MODE 1
+
+namespace
+{
+/**
+ * @brief Разбор списка процессоров или узлов вида "0-3,8,10-11".
+ */
+std::vector<int> parseCpuList(const std::string &text)
+{
+    std::vector<int> cpus;
+    std::stringstream stream(text);
+    std::string range;
+    while (std::getline(stream, range, ','))
+    {
+        if (range.empty() || range == "\n")
+        {
+            continue;
+        }
+        auto dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @brief Узел NUMA.
+ */
+struct NumaNode
+{
+    int id = 0;            ///< Номер узла в системе (номера могут идти с пропусками).
+    std::vector<int> cpus; ///< Процессоры узла.
+};
+
+/**
+ * @brief Узлы NUMA в сети (/sys/devices/system/node/online); читаются один раз.
+ */
+const std::vector<NumaNode> &topology()
+{
+    static const std::vector<NumaNode> nodes = []()
+    {
+        std::vector<NumaNode> result;
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string text;
+        if (online && std::getline(online, text))
+        {
+            for (int id : parseCpuList(text))
+            {
+                std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+                std::string cpus;
+                if (file && std::getline(file, cpus))
+                {
+                    result.push_back({id, parseCpuList(cpus)});
+                }
+            }
+        }
+        if (result.empty())
+        {
+            result.emplace_back();
+        }
+        return result;
+    }();
+    return nodes;
+}
+
+/**
+ * @brief Анонимное отображение, выровненное на огромную страницу.
+ *
+ * @return Адрес или MAP_FAILED
+ */
+void *mapAligned(size_t length, bool huge_pages)
+{
+    if (huge_pages)
+    {
+        // Явные огромные страницы требуют заранее выделенного пула (vm.nr_hugepages).
+        void *address = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (address != MAP_FAILED)
+        {
+            return address;
+        }
+    }
+
+    // Прозрачные огромные страницы выделяются только в выровненных на 2 МБ диапазонах.
+    size_t padded = length + HUGE_PAGE_SIZE;
+    void *raw = ::mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return MAP_FAILED;
+    }
+    auto begin = reinterpret_cast<uintptr_t>(raw);
+    auto aligned = (begin + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if (aligned > begin)
+    {
+        ::munmap(raw, aligned - begin);
+    }
+    if (begin + padded > aligned + length)
+    {
+        ::munmap(reinterpret_cast<void *>(aligned + length), begin + padded - aligned - length);
+    }
+    if (huge_pages)
+    {
+        ::madvise(reinterpret_cast<void *>(aligned), length, MADV_HUGEPAGE);
+    }
+    return reinterpret_cast<void *>(aligned);
+}
+} // namespace
+
+namespace placement
+{
+size_t nodeCount()
+{
+    return topology().size();
+}
+
+const std::vector<int> &nodeCpus(size_t node)
+{
+    return topology()[node % topology().size()].cpus;
+}
+
+std::shared_ptr<float[]> allocateFloats(size_t count, const MemoryOptions &options, size_t node)
+{
+    size_t bytes = count * sizeof(float);
+    bool bind = options.numa && nodeCount() > 1;
+    if ((!options.huge_pages && !bind) || bytes < HUGE_PAGE_SIZE)
+    {
+        return std::shared_ptr<float[]>(new float[count]);
+    }
+
+    size_t length = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    void *address = mapAligned(length, options.huge_pages);
+    if (address == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+
+    auto id = static_cast<size_t>(topology()[node % nodeCount()].id);
+    if (bind && id < 8 * sizeof(unsigned long) * 4)
+    {
+        // Страницы ещё не тронуты: политика применится при первой записи.
+        unsigned long mask[4] = {};
+        mask[id / (8 * sizeof(unsigned long))] = 1ul << (id % (8 * sizeof(unsigned long)));
+        if (::syscall(SYS_mbind, address, length, MPOL_PREFERRED_MODE, mask, 8 * sizeof(mask), 0) != 0)
+        {
+            std::cerr << "mbind failed for NUMA node " << id << std::endl;
+        }
+    }
+    return std::shared_ptr<float[]>(static_cast<float *>(address), [length](float *data) { ::munmap(data, length); });
+}
+
+void pinToNode(size_t node)
+{
+    thread_local size_t pinned_node = static_cast<size_t>(-1);
+    node %= nodeCount();
+    if (pinned_node == node || nodeCpus(node).empty())
+    {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : nodeCpus(node))
+    {
+        if (cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (::syscall(SYS_sched_setaffinity, 0, sizeof(set), &set) == 0)
+    {
+        pinned_node = node;
+    }
+}
+} // namespace placement
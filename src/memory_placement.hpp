@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Размещение матрицы эмбеддингов в памяти.
+ */
+struct MemoryOptions
+{
+    bool huge_pages = false; ///< Огромные страницы 2 МБ (MAP_HUGETLB, иначе прозрачные огромные страницы).
+    bool numa = false;       ///< Распределять сегменты по узлам NUMA и сканировать их потоками своего узла.
+};
+
+/**
+ * @brief Выделение памяти с огромными страницами и привязкой к узлам NUMA.
+ *
+ * Используются системные вызовы mmap/mbind/sched_setaffinity напрямую, без libnuma.
+ * Топология узлов читается из /sys/devices/system/node. Узлы нумеруются подряд с нуля
+ * в порядке списка узлов в сети; системные номера узлов могут идти с пропусками.
+ */
+namespace placement
+{
+/**
+ * @brief Количество узлов NUMA (1, если топология недоступна).
+ */
+size_t nodeCount();
+
+/**
+ * @brief Процессоры узла NUMA.
+ */
+const std::vector<int> &nodeCpus(size_t node);
+
+/**
+ * @brief Массив float с заданным размещением.
+ *
+ * Небольшие массивы (меньше огромной страницы) выделяются обычным new[].
+ *
+ * @param count - количество элементов
+ * @param options - параметры размещения
+ * @param node - узел NUMA (учитывается при options.numa)
+ * @throws std::bad_alloc, если память не выделена
+ */
+std::shared_ptr<float[]> allocateFloats(size_t count, const MemoryOptions &options, size_t node);
+
+/**
+ * @brief Привязать текущий поток к процессорам узла NUMA.
+ *
+ * Привязка сохраняется до конца жизни потока, поэтому вызывается только в потоках,
+ * отведённых под этот узел. Повторная привязка к тому же узлу не выполняет системный вызов.
+ */
+void pinToNode(size_t node);
+} // namespace placement
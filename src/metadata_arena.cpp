@@ -0,0 +1,47 @@
+#include "metadata_arena.hpp"
+#include <algorithm>
+
+/// Начальный размер блока; следующие блоки удваиваются до ARENA_MAX_BLOCK.
+#define ARENA_MIN_BLOCK (16 << 10)
+#define ARENA_MAX_BLOCK (1 << 20)
+
+std::string_view MetadataArena::append(std::string_view text)
+{
+    if (text.empty())
+    {
+        return {};
+    }
+    char *data = allocate(text.size());
+    std::copy(text.begin(), text.end(), data);
+    return {data, text.size()};
+}
+
+char *MetadataArena::allocate(size_t bytes)
+{
+    if (bytes == 0)
+    {
+        return nullptr;
+    }
+    if (blocks.empty() || block_capacity - block_used < bytes)
+    {
+        size_t grow = std::min<size_t>(ARENA_MAX_BLOCK, std::max<size_t>(ARENA_MIN_BLOCK, block_capacity * 2));
+        block_capacity = std::max(bytes, grow);
+        block_used = 0;
+        blocks.emplace_back(new char[block_capacity]);
+        allocated.fetch_add(block_capacity, std::memory_order_relaxed);
+    }
+    char *data = blocks.back().get() + block_used;
+    block_used += bytes;
+    total += bytes;
+    return data;
+}
+
+size_t MetadataArena::size() const
+{
+    return total;
+}
+
+size_t MetadataArena::capacity() const
+{
+    return allocated.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Хранилище текстов метаданных: тексты пишутся подряд в крупные блоки.
+ *
+ * Блоки не перемещаются и освобождаются только вместе с хранилищем, поэтому
+ * std::string_view на записанный текст действителен, пока жив владелец хранилища.
+ * Запись выполняет один писатель (под write_mutex БД); читатели обращаются только
+ * к уже опубликованным текстам, а из самого хранилища читают лишь capacity().
+ */
+class MetadataArena
+{
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t block_capacity = 0; ///< Ёмкость последнего блока.
+    size_t block_used = 0;     ///< Занято в последнем блоке.
+    size_t total = 0;          ///< Сумма длин записанных текстов.
+    std::atomic<size_t> allocated{0}; ///< Сумма ёмкостей блоков.
+
+public:
+    /**
+     * @brief Копирует текст в хранилище.
+     *
+     * @return std::string_view - копия текста в хранилище
+     */
+    std::string_view append(std::string_view text);
+
+    /**
+     * @brief Непрерывный участок для заполнения извне (например, чтением из файла).
+     *
+     * @param bytes - размер участка
+     * @return char* - начало участка
+     */
+    char *allocate(size_t bytes);
+
+    /**
+     * @brief Сумма длин записанных текстов.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Объём выделенных блоков; можно читать параллельно с записью.
+     */
+    size_t capacity() const;
+};
@@ -0,0 +1,154 @@
+#include "packed_metadata.hpp"
+#include "lz_codec.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <utility>
+
+/// Сколько распакованных блоков хранит общий кэш.
+#define METADATA_CACHE_BLOCKS 64
+
+namespace
+{
+/**
+ * @brief Общий кэш распакованных блоков с вытеснением давно не использованных.
+ *
+ * Ключ - идентификатор PackedMetadata и номер блока; блоки освобождённых сегментов
+ * не используются повторно и вытесняются со временем.
+ */
+class BlockCache
+{
+    using Key = std::pair<uint64_t, size_t>;
+
+    std::list<MetadataBlock> lru; ///< Начало - недавно использованные.
+    std::map<Key, std::list<MetadataBlock>::iterator> entries;
+    std::mutex mutex;
+
+public:
+    MetadataBlock find(uint64_t owner, size_t index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find({owner, index});
+        if (it == entries.end())
+        {
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        return *it->second;
+    }
+
+    void insert(const MetadataBlock &block)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.count({block->owner, block->index}))
+        {
+            return;
+        }
+        lru.push_front(block);
+        entries[{block->owner, block->index}] = lru.begin();
+        if (lru.size() > METADATA_CACHE_BLOCKS)
+        {
+            entries.erase({lru.back()->owner, lru.back()->index});
+            lru.pop_back();
+        }
+    }
+};
+
+BlockCache &blockCache()
+{
+    static BlockCache cache;
+    return cache;
+}
+
+std::atomic<uint64_t> next_packed_id{1};
+} // namespace
+
+PackedMetadata::PackedMetadata(std::vector<uint64_t> offsets,
+                               std::vector<uint64_t> block_rows,
+                               std::vector<uint64_t> block_offsets,
+                               std::shared_ptr<const char> data)
+    : id(next_packed_id++),
+      offsets(std::move(offsets)),
+      block_rows(std::move(block_rows)),
+      block_offsets(std::move(block_offsets)),
+      data(std::move(data))
+{
+}
+
+size_t PackedMetadata::rows() const
+{
+    return offsets.size() - 1;
+}
+
+size_t PackedMetadata::textSize(size_t row) const
+{
+    return offsets[row + 1] - offsets[row];
+}
+
+std::string_view PackedMetadata::text(size_t row, MetadataBlock &block) const
+{
+    size_t index = std::upper_bound(block_rows.begin(), block_rows.end(), row) - block_rows.begin() - 1;
+    if (!block || block->owner != id || block->index != index)
+    {
+        block = blockCache().find(id, index);
+    }
+    if (!block)
+    {
+        auto decoded = std::make_shared<DecodedBlock>();
+        decoded->owner = id;
+        decoded->index = index;
+        decoded->text.resize(offsets[block_rows[index + 1]] - offsets[block_rows[index]]);
+        auto packed = packedBlock(index);
+        if (packed.size() == decoded->text.size())
+        {
+            std::copy(packed.begin(), packed.end(), decoded->text.begin());
+        }
+        else if (!lz::decompress(packed.data(), packed.size(), decoded->text.data(), decoded->text.size()))
+        {
+            std::cerr << "Ошибка: повреждён блок метаданных " << index << std::endl;
+            decoded->text.clear();
+            block = std::move(decoded);
+            return {};
+        }
+        block = std::move(decoded);
+        blockCache().insert(block);
+    }
+    if (block->text.empty())
+    {
+        return {};
+    }
+    return std::string_view(block->text).substr(offsets[row] - offsets[block_rows[index]], textSize(row));
+}
+
+size_t PackedMetadata::blocks() const
+{
+    return block_rows.size() - 1;
+}
+
+size_t PackedMetadata::blockRow(size_t index) const
+{
+    return block_rows[index];
+}
+
+std::string_view PackedMetadata::packedBlock(size_t index) const
+{
+    return {data.get() + block_offsets[index], block_offsets[index + 1] - block_offsets[index]};
+}
+
+size_t PackedMetadata::memoryUsage() const
+{
+    return block_offsets.back() + (offsets.size() + block_rows.size() + block_offsets.size()) * sizeof(uint64_t);
+}
+
+void PackedMetadata::packBlock(std::string_view text, std::string &output)
+{
+    size_t start = output.size();
+    if (lz::compress(text, output) >= text.size())
+    {
+        output.resize(start);
+        output.append(text);
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Распакованный блок метаданных.
+ */
+struct DecodedBlock
+{
+    uint64_t owner = 0; ///< Идентификатор PackedMetadata, которому принадлежит блок.
+    size_t index = 0;   ///< Номер блока.
+    std::string text;   ///< Тексты строк блока подряд.
+};
+
+/// Удерживает распакованный блок, пока используются ссылки на его тексты.
+using MetadataBlock = std::shared_ptr<const DecodedBlock>;
+
+/**
+ * @brief Метаданные строк сегмента, сжатые независимыми блоками.
+ *
+ * Каждый блок покрывает несколько соседних строк и распаковывается отдельно, поэтому
+ * выборка нескольких строк распаковывает только их блоки. Недавно распакованные блоки
+ * хранятся в общем для всех БД кэше небольшого размера.
+ */
+class PackedMetadata
+{
+    uint64_t id;                        ///< Уникальный ключ блоков в кэше.
+    std::vector<uint64_t> offsets;      ///< Смещения текстов строк в распакованных данных (rows + 1).
+    std::vector<uint64_t> block_rows;   ///< Первая строка каждого блока (blocks + 1).
+    std::vector<uint64_t> block_offsets; ///< Смещения сжатых блоков в data (blocks + 1).
+    std::shared_ptr<const char> data;   ///< Сжатые блоки: собственный буфер или отображение файла.
+
+public:
+    /**
+     * @param offsets - смещения текстов строк (rows + 1, начиная с 0)
+     * @param block_rows - первые строки блоков (blocks + 1, от 0 до rows)
+     * @param block_offsets - смещения сжатых блоков (blocks + 1, начиная с 0)
+     * @param data - сжатые блоки
+     */
+    PackedMetadata(std::vector<uint64_t> offsets,
+                   std::vector<uint64_t> block_rows,
+                   std::vector<uint64_t> block_offsets,
+                   std::shared_ptr<const char> data);
+
+    /**
+     * @brief Количество строк.
+     */
+    size_t rows() const;
+
+    /**
+     * @brief Длина текста строки без распаковки.
+     */
+    size_t textSize(size_t row) const;
+
+    /**
+     * @brief Текст строки.
+     *
+     * Если block уже содержит нужный блок, кэш не используется. Повреждённый блок
+     * даёт пустой текст.
+     *
+     * @param row - строка
+     * @param block - распакованный блок; текст действителен, пока он удерживается
+     * @return std::string_view - текст строки
+     */
+    std::string_view text(size_t row, MetadataBlock &block) const;
+
+    /**
+     * @brief Количество блоков.
+     */
+    size_t blocks() const;
+
+    /**
+     * @brief Первая строка блока (blocks() - количество строк).
+     */
+    size_t blockRow(size_t index) const;
+
+    /**
+     * @brief Сжатые данные блока.
+     */
+    std::string_view packedBlock(size_t index) const;
+
+    /**
+     * @brief Объём сжатых данных и смещений.
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * @brief Сжать тексты блока.
+     *
+     * Если сжатие не уменьшает размер, блок хранится без сжатия: размер сжатого блока
+     * равен размеру исходного.
+     *
+     * @param text - тексты строк блока подряд
+     * @param output - сюда дописывается блок
+     */
+    static void packBlock(std::string_view text, std::string &output);
+};
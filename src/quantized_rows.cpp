@@ -0,0 +1,60 @@
+#include "quantized_rows.hpp"
+#include <algorithm>
+#include <cmath>
+
+QuantizedRows::QuantizedRows(size_t rows, size_t dimension)
+    : codes(new int8_t[rows * dimension]),
+      scales(new float[rows])
+{
+}
+
+namespace quantization
+{
+float quantize(const float *vector, size_t dimension, int8_t *codes)
+{
+    float largest = 0.0f;
+    for (size_t i = 0; i < dimension; ++i)
+    {
+        largest = std::max(largest, std::fabs(vector[i]));
+    }
+    float scale = largest / 127.0f;
+    float inverse = scale > 0.0f ? 1.0f / scale : 0.0f;
+    for (size_t i = 0; i < dimension; ++i)
+    {
+        codes[i] = static_cast<int8_t>(std::lround(vector[i] * inverse));
+    }
+    return scale;
+}
+
+void quantizeRows(const float *rows, size_t count, size_t dimension, int8_t *codes, float *scales)
+{
+    for (size_t row = 0; row < count; ++row)
+    {
+        scales[row] = quantize(rows + row * dimension, dimension, codes + row * dimension);
+    }
+}
+
+int32_t dot(const int8_t *a, const int8_t *b, size_t n)
+{
+    // Независимые суммы компилятор раскладывает в SIMD-регистр, как в dotProduct для float.
+    int32_t acc[16] = {};
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        for (size_t j = 0; j < 16; ++j)
+        {
+            acc[j] += int32_t(a[i + j]) * int32_t(b[i + j]);
+        }
+    }
+    int32_t sum = 0;
+    for (size_t j = 0; j < 16; ++j)
+    {
+        sum += acc[j];
+    }
+    for (; i < n; ++i)
+    {
+        sum += int32_t(a[i]) * int32_t(b[i]);
+    }
+    return sum;
+}
+} // namespace quantization
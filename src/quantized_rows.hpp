@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Компактная копия эмбеддингов сегмента: int8 на координату и масштаб на строку.
+ *
+ * Координата строки row приближённо равна codes[row * dimension + i] * scales[row].
+ * Копия в четыре раза меньше полных векторов и используется на первом, приближённом
+ * этапе поиска, когда полные векторы остаются в файле.
+ */
+struct QuantizedRows
+{
+    std::unique_ptr<int8_t[]> codes;  ///< Коды координат (rows x dimension).
+    std::unique_ptr<float[]> scales;  ///< Масштаб каждой строки.
+
+    QuantizedRows(size_t rows, size_t dimension);
+};
+
+/**
+ * @brief Запрос, квантованный тем же способом, что и строки.
+ */
+struct QuantizedQuery
+{
+    std::vector<int8_t> codes;
+    float scale = 0.0f;
+};
+
+namespace quantization
+{
+/**
+ * @brief Квантовать вектор: симметричная шкала по наибольшему модулю координаты.
+ *
+ * @param vector - вектор
+ * @param dimension - размерность
+ * @param codes - сюда пишутся dimension кодов
+ * @return float - масштаб
+ */
+float quantize(const float *vector, size_t dimension, int8_t *codes);
+
+/**
+ * @brief Квантовать count строк подряд.
+ */
+void quantizeRows(const float *rows, size_t count, size_t dimension, int8_t *codes, float *scales);
+
+/**
+ * @brief Скалярное произведение кодов.
+ */
+int32_t dot(const int8_t *a, const int8_t *b, size_t n);
+} // namespace quantization
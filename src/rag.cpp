@@ -2,32 +2,155 @@
 #include "cpr/api.h"
 #include "json.hpp"
 #include "vector_db.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #define BATCH 1024
 #define DEBUG
 
+// Неизменная часть промпта: llama-server кэширует её KV-состояние между запросами.
+static const char system_prompt[] =
+    "<|im_start|>system\n Ты - полезный AI-ассистент. Ответь на вопрос пользователя, "
+    "используя ТОЛЬКО предоставленную информацию из базы знаний. Если в предоставленной "
+    "информации нет достаточных данных для ответа, честно скажи об этом. Будь точным, "
+    "кратким и используй только факты из контекста. Основываясь на предоставленной "
+    "информации, дай точный и краткий ответ.\n<|im_end|>\n";
+// "<|im_start|>system\n Ты - персонаж, характеристика которого будет передана тебе в виде контекста. Твоя задача мимкрировать под персонажа и отвечать пользователю от его лица. Отвечай разговорной речью как будто в переписке в социальной сети\n<|im_end|>\n";
 
-Rag::Rag(/*int dim*/)
+// Объём текста эмбеддинга (байт), задержка которого для ограничителя считается одной единицей
+// нагрузки: вопрос и фрагмент по умолчанию - одна единица, пакет из n фрагментов - n единиц.
+#define EMBEDDING_LOAD_UNIT_BYTES 1024
+
+namespace
+{
+double millisecondsSince(std::chrono::steady_clock::time_point start)
 {
-    if (auto r = cpr::Head(model_address); r.status_code == 0)
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Задержка эмбеддинга в пересчёте на единицу нагрузки (для ConcurrencyLimiter).
+ *
+ * Без нормирования пакетные запросы и длинные фрагменты выглядели бы для ограничителя
+ * перегрузкой относительно коротких вопросов.
+ */
+double embeddingLoadLatency(double latency_ms, size_t bytes)
+{
+    return latency_ms / std::max(1.0, static_cast<double>(bytes) / EMBEDDING_LOAD_UNIT_BYTES);
+}
+
+/**
+ * @brief Время до первого токена ответа /completion без потоковой передачи.
+ *
+ * Полная задержка зависит от длины ответа, а не от загрузки сервера; время генерации
+ * (timings.predicted_ms) вычитается, остаются ожидание слота и обработка промпта.
+ */
+double firstTokenLatency(double latency_ms, const nlohmann::json &response)
+{
+    if (response.contains("timings") && response["timings"].is_object())
     {
-        std::cerr << "Failed to init connection to model!\n";
-        throw std::runtime_error(r.error.message);
+        double predicted_ms = response["timings"].value("predicted_ms", 0.0);
+        if (predicted_ms > 0.0 && predicted_ms < latency_ms)
+        {
+            return latency_ms - predicted_ms;
+        }
+    }
+    return latency_ms;
+}
+
+/**
+ * @brief Разбор одного элемента ответа /embedding.
+ *
+ * @param item - объект вида {"embedding": [[...]]}
+ * @param dim - ожидаемая размерность (0 - не проверять)
+ */
+std::vector<float> parseEmbedding(const nlohmann::json &item, int dim)
+{
+    std::vector<float> m;
+    if (item.contains("embedding") && item["embedding"].is_array() && !item["embedding"].empty() &&
+        item["embedding"][0].is_array())
+    {
+        for (const auto &val : item["embedding"][0])
+        {
+            if (val.is_number())
+            {
+                m.push_back(val.get<float>());
+            }
+            else
+            {
+                throw std::runtime_error("Embedding value is not a number");
+            }
+        }
     }
-    if (auto r = cpr::Head(embeder_address); r.status_code == 0)
+    else
     {
-        std::cerr << "Failed to init connection to embedder!\n";
-        throw std::runtime_error(r.error.message);
+        std::cerr << item << std::endl;
+        throw std::runtime_error("Invalid response format: expected array of embeddings");
+    }
+
+    if (dim > 0 && m.size() != static_cast<size_t>(dim))
+    {
+        throw std::runtime_error("Embedder returned vector with wrong size: " + std::to_string(m.size()) +
+                                 ". Expected: " + std::to_string(dim));
+    }
+    return m;
+}
+
+std::vector<VectorRecord> toRecords(std::vector<std::vector<float>> &&embeddings, std::vector<std::string> &&texts)
+{
+    std::vector<VectorRecord> records(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        records[i].embedding = std::move(embeddings[i]);
+        records[i].metadata = std::move(texts[i]);
+    }
+    return records;
+}
+
+nlohmann::json completionPayload(const std::string &prompt,
+                                 int n_predict,
+                                 float temperature,
+                                 int top_k,
+                                 bool stream,
+                                 int id_slot)
+{
+    nlohmann::json payload = {{"prompt", prompt},
+                              {"n_predict", n_predict},
+                              {"temperature", temperature},
+                              {"top_k", top_k},
+                              {"stream", stream},
+                              {"cache_prompt", true},
+                              {"stop", {"<|im_end|>"}}};
+    // Закрепление диалога за слотом: уточняющие вопросы попадут в тот же KV-кэш.
+    if (id_slot >= 0)
+    {
+        payload["id_slot"] = id_slot;
     }
+    return payload;
+}
+} // namespace
+
+
+Rag::Rag(int dim) : dim(dim)
+{
+    // Один слот эмбедера всегда остаётся за вопросами пользователей.
+    embedder_scheduler.configure(RequestPriority::interactive, 1, 0);
+
+    mapping_options.enabled = DATABASE_MMAP;
 
-    this->dim = dim;
-    this->dim = static_cast<int>(this->embedText("Test text").size());
-    std::cerr << "dim is setted!\n";
+    // Серверы проверяются в фоне: запуск не зависит от их доступности и задержки.
+    health.start();
     initDatabaseList();
 }
 
@@ -37,79 +160,286 @@ std::string Rag::request(std::string question,
                          float temperature,
                          int top_k,
                          int rag_k,
-                         float rag_sim_threshold)
+                         float rag_sim_threshold,
+                         int id_slot)
+{
+    auto payload = completionPayload(buildPrompt(question, database_id_list, rag_k, rag_sim_threshold),
+                                     n_predict,
+                                     temperature,
+                                     top_k,
+                                     false,
+                                     id_slot);
+
+    auto ticket = model_scheduler.admit(RequestPriority::interactive);
+    auto start = std::chrono::steady_clock::now();
+    cpr::Response r =
+        cpr::Post(model_address, cpr::Header{{"Content-Type", "application/json"}}, cpr::Body{payload.dump()});
+    double latency_ms = millisecondsSince(start);
+
+    if (r.status_code == 200)
+    {
+        try
+        {
+            auto response_json = nlohmann::json::parse(r.text);
+            ticket.release(firstTokenLatency(latency_ms, response_json), true);
+            return response_json.value("content", "");
+        }
+        catch (const std::exception &e)
+        {
+            ticket.release(latency_ms, false);
+            return "";
+        }
+    }
+    ticket.release(latency_ms, false);
+    return "";
+}
+
+std::string Rag::requestStream(std::string question,
+                               std::vector<int> database_id_list,
+                               std::function<void(const std::string &)> on_token,
+                               int n_predict,
+                               float temperature,
+                               int top_k,
+                               int rag_k,
+                               float rag_sim_threshold,
+                               int id_slot)
 {
-    std::string context = "Контекст из базы данных для использования в ответе:\n";
+    auto payload = completionPayload(buildPrompt(question, database_id_list, rag_k, rag_sim_threshold),
+                                     n_predict,
+                                     temperature,
+                                     top_k,
+                                     true,
+                                     id_slot);
+
+    std::string answer;
+    std::string pending;
+    std::exception_ptr callback_error;
+    // Ограничителю передаётся время до первого токена: полная задержка потока зависит от длины ответа.
+    auto start = std::chrono::steady_clock::now();
+    double first_token_ms = -1.0;
+
+    // llama-server отвечает событиями SSE вида "data: {...}\n\n", куски ответа
+    // могут разрывать строки, поэтому неполная строка остаётся в pending.
+    auto on_data = [&](const std::string_view &data, intptr_t) -> bool
+    {
+        pending.append(data.data(), data.size());
+        size_t line_end;
+        while ((line_end = pending.find('\n')) != std::string::npos)
+        {
+            std::string line = pending.substr(0, line_end);
+            pending.erase(0, line_end + 1);
+            if (line.rfind("data: ", 0) != 0)
+            {
+                continue;
+            }
+
+            nlohmann::json event;
+            try
+            {
+                event = nlohmann::json::parse(line.substr(6));
+            }
+            catch (const nlohmann::json::exception &e)
+            {
+                continue;
+            }
+
+            auto token = event.value("content", "");
+            if (token.empty())
+            {
+                continue;
+            }
+            if (first_token_ms < 0.0)
+            {
+                first_token_ms = millisecondsSince(start);
+            }
+            answer += token;
+            try
+            {
+                on_token(token);
+            }
+            catch (...)
+            {
+                // Прерываем передачу, исключение пробрасывается после завершения запроса.
+                callback_error = std::current_exception();
+                return false;
+            }
+        }
+        return true;
+    };
+
+    auto ticket = model_scheduler.admit(RequestPriority::interactive);
+    start = std::chrono::steady_clock::now();
+    cpr::Response r = cpr::Post(model_address,
+                                cpr::Header{{"Content-Type", "application/json"}},
+                                cpr::Body{payload.dump()},
+                                cpr::WriteCallback{on_data});
+    ticket.release(first_token_ms < 0.0 ? millisecondsSince(start) : first_token_ms,
+                   r.status_code == 200 || callback_error);
+
+    if (callback_error)
+    {
+        std::rethrow_exception(callback_error);
+    }
+    if (r.status_code != 200)
+    {
+        // Тело ответа с ошибкой ушло в on_data и не разобрано как события: остаток в pending.
+        throw std::runtime_error("Model request failed (HTTP " + std::to_string(r.status_code) +
+                                 "): " + (r.error.message.empty() ? pending : r.error.message));
+    }
+    return answer;
+}
 
-    auto embeded_question = this->embedText(question);
+std::string Rag::buildPrompt(const std::string &question,
+                             const std::vector<int> &database_id_list,
+                             int rag_k,
+                             float rag_sim_threshold)
+{
+    auto embeded_question = this->embedText(question, RequestPriority::interactive);
     std::cout << database_id_list.size() << std::endl;
+
+    std::vector<ContextCandidate> candidates;
     for (auto db_id : database_id_list)
     {
         std::cout << "\nSelected ID" << db_id << std::endl;
-        auto temp = this->vector_database_list[db_id].findTopK(embeded_question, rag_k, rag_sim_threshold);
+        auto handle = databases.find(db_id);
+        if (!handle)
+        {
+            std::cerr << "Unknown database id: " << db_id << std::endl;
+            continue;
+        }
+        residency.use(handle);
+        auto &db = *handle;
+        // Поиск, позиции и метаданные берутся из одного снимка; метаданные читаются через общий блок распаковки.
+        auto snap = db.snapshot();
+        auto temp = db.findTopK(*snap, embeded_question, rag_k, rag_sim_threshold);
         std::cout << temp.size() << std::endl;
+        MetadataBlock block;
         for (auto id : temp)
         {
+            // Запись могла быть удалена после поиска: пометки удаления общие для всех снимков.
+            auto position = VectorDatabase::getPosition(*snap, id.first);
+            if (position == snap->rows)
+            {
+                continue;
+            }
+            ContextCandidate candidate;
+            candidate.database_id = db_id;
+            candidate.position = position;
+            candidate.id = id.first;
+            candidate.score = id.second;
+            if (!chunkText(VectorDatabase::getMetadata(*snap, id.first, block), candidate))
+            {
+                continue;
+            }
 #ifdef DEBUG
             std::cout << id.second << std::endl;
-            std::cout << vector_database_list[db_id].getMetadata(id.first) << std::endl;
+            std::cout << candidate.text << std::endl;
 #endif // DEBUG
-            context += vector_database_list[db_id].getMetadata(id.first) + "\n";
+            candidates.push_back(std::move(candidate));
         }
     }
 
+    auto fragments = context_packer.pack(std::move(candidates), context_token_budget);
+    if (compression_enabled)
+    {
+        fragments = context_compressor.compress(std::move(fragments), embeded_question, compression_token_budget);
+    }
+
+    std::string context;
+    for (const auto &fragment : fragments)
+    {
+        context += fragment.text + "\n";
+    }
+
 #ifdef DEBUG
     std::cout << context + "Запрос пользователя:\n" + question << std::endl;
 #endif // DEBUG
 
+    // Порядок частей от самой стабильной к самой изменчивой: системный промпт
+    // одинаков для всех запросов, контекст повторяется у уточняющих вопросов,
+    // вопрос меняется всегда.
+    return std::string(system_prompt) +
+           "<|im_start|>user\nКонтекст из базы данных для использования в ответе:\n" + context +
+           "<|im_end|>\n<|im_start|>user\nВопрос: " + question + "\n<|im_end|>\n<|im_start|>assistant\n";
+}
 
-    nlohmann::json payload = {{"prompt",
-                               "<|im_start|>system\n Ты - полезный AI-ассистент. Ответь на вопрос пользователя, "
-                               "используя ТОЛЬКО предоставленную информацию из базы знаний. Если в предоставленной "
-                               "информации нет достаточных данных для ответа, честно скажи об этом. Будь точным, "
-                               "кратким и используй только факты из контекста.\n<|im_end|>\n<|im_start|>user\n" +
-                                   context + "Вопрос: " + question +
-                                   "Основываясь на предоставленной информации выше, дай точный и краткий "
-                                   "ответ.\n<|im_end|>\n<|im_start|>assistant\n"
-                            // "<|im_start|>system\n Ты - персонаж, характеристика которого будет передана тебе в виде контекста. Твоя задача мимкрировать под персонажа и отвечать пользователю от его лица. Отвечай разговорной речью как будто в переписке в социальной сети\n<|im_end|>\n<|im_start|>user\n" +
-                            //        context + "Вопрос: " + question +
-                            //        "<|im_end|>\n<|im_start|>assistant\n"
-                            },
+void Rag::addDocument(std::string filename, int batch_size, int database_id)
+{
+    indexDocument(filename, generatorType::chunk, batch_size, *getDatabase(database_id));
+}
 
-                              {"n_predict", n_predict},
-                              {"temperature", temperature},
-                              {"top_k", top_k},
-                              {"stream", false},
-                              {"stop", {"<|im_end|>"}}};
+void Rag::addDocumentByParagraphs(std::string filename, int database_id)
+{
+    indexDocument(filename, generatorType::paragraphs, 0, *getDatabase(database_id));
+}
 
-    cpr::Response r =
-        cpr::Post(model_address, cpr::Header{{"Content-Type", "application/json"}}, cpr::Body{payload.dump()});
+void Rag::indexDocument(const std::string &filename, generatorType type, int batch_size, VectorDatabase &db)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Cannot open file: " + filename);
+    }
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
 
-    if (r.status_code == 200)
+    std::vector<std::pair<size_t, size_t>> spans;
+    switch (type)
     {
-        try
-        {
-            auto response_json = nlohmann::json::parse(r.text);
-            return response_json.value("content", "");
-        }
-        catch (const std::exception &e)
+    case generatorType::chunk:
+        spans = splitChunks(content, batch_size);
+        break;
+    case generatorType::paragraphs:
+        spans = splitParagraphs(content);
+        break;
+    default:
+        break;
+    }
+
+    std::vector<std::string> texts;
+    texts.reserve(spans.size());
+    for (const auto &span : spans)
+    {
+        texts.push_back(content.substr(span.first, span.second));
+    }
+    auto embeddings = embedTexts(texts);
+
+    if (source_references)
+    {
+        // Файл регистрируется после получения векторов: при ошибке эмбедера индекс не растёт.
+        auto document = sources.addDocument(filename, content);
+        for (size_t i = 0; i < spans.size(); ++i)
         {
-            return "";
+            texts[i] = SourceStore::encode({document, spans[i].first, spans[i].second, SourceStore::hash(texts[i])});
         }
     }
-    return "";
+    if (db.addEmbeddings(toRecords(std::move(embeddings), std::move(texts))).size() != spans.size())
+    {
+        throw std::runtime_error("Failed to add embeddings of " + filename + " to the database");
+    }
 }
 
-void Rag::addDocument(std::string filename, int batch_size, int database_id)
+bool Rag::chunkText(std::string_view metadata, ContextCandidate &candidate)
 {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open())
+    SourceReference reference;
+    if (!SourceStore::decode(metadata, reference))
     {
-        throw std::runtime_error("Cannot open file: " + filename);
+        candidate.text.assign(metadata);
+        return true;
     }
-    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    file.close();
-    std::vector<std::string> chunks;
+    if (!sources.resolve(reference, candidate.text))
+    {
+        std::cerr << "Фрагмент пропущен: источник " << reference.document << " изменён или недоступен" << std::endl;
+        return false;
+    }
+    candidate.document = reference.document;
+    candidate.offset = reference.offset;
+    return true;
+}
+
+std::vector<std::pair<size_t, size_t>> Rag::splitChunks(const std::string &content, int batch_size)
+{
+    std::vector<std::pair<size_t, size_t>> chunks;
     size_t pos = 0;
 
     while (pos < content.size())
@@ -143,85 +473,94 @@ void Rag::addDocument(std::string filename, int batch_size, int database_id)
             ++char_count;
         }
 
-        chunks.push_back(content.substr(start, pos - start));
+        pos = std::min(pos, content.size());
+        chunks.emplace_back(start, pos - start);
     }
 
-    for (const auto &chunk : chunks)
-    {
-        auto embeding = embedText(chunk);
-        vector_database_list[database_id].addEmbedding(embeding, chunk);
-    }
+    return chunks;
 }
 
-void Rag::addDocumentByParagraphs(std::string filename, int database_id)
+std::vector<std::pair<size_t, size_t>> Rag::splitParagraphs(const std::string &content)
 {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open())
-    {
-        throw std::runtime_error("Cannot open file: " + filename);
-    }
-
-    std::string line;
-    std::string paragraph;
+    // Параграф - непрерывный участок текста от первой до последней непустой строки,
+    // поэтому его можно хранить ссылкой на исходный файл.
+    std::vector<std::pair<size_t, size_t>> paragraphs;
+    size_t paragraph_start = std::string::npos;
+    size_t paragraph_end = 0;
+    size_t pos = 0;
 
-    while (std::getline(file, line))
+    while (pos < content.size())
     {
-        if (line.empty())
+        size_t line_end = content.find('\n', pos);
+        if (line_end == std::string::npos)
+        {
+            line_end = content.size();
+        }
+
+        if (line_end == pos)
         {
-            if (!paragraph.empty())
+            if (paragraph_start != std::string::npos)
             {
-                auto embedding = embedText(paragraph);
 #ifdef DEBUG
-                std::cout << paragraph << std::endl;
+                std::cout << content.substr(paragraph_start, paragraph_end - paragraph_start) << std::endl;
 #endif // DEBUG
-                vector_database_list[database_id].addEmbedding(embedding, paragraph);
-                paragraph.clear();
+                paragraphs.emplace_back(paragraph_start, paragraph_end - paragraph_start);
+                paragraph_start = std::string::npos;
             }
         }
         else
         {
-            if (!paragraph.empty())
+            if (paragraph_start == std::string::npos)
             {
-                paragraph += "\n";
+                paragraph_start = pos;
             }
-            paragraph += line;
+            paragraph_end = line_end;
         }
+        pos = line_end + 1;
     }
-    if (!paragraph.empty())
+    if (paragraph_start != std::string::npos)
     {
-        auto embedding = embedText(paragraph);
-        vector_database_list[database_id].addEmbedding(embedding, paragraph);
+        paragraphs.emplace_back(paragraph_start, paragraph_end - paragraph_start);
     }
 
-    file.close();
+    return paragraphs;
 }
 
-void Rag::createDatabase(std::string filename, std::vector<std::string> files, generatorType type)
+int Rag::createDatabase(std::string filename, std::vector<std::string> files, generatorType type)
 {
-    VectorDatabase new_db{filename, static_cast<size_t>(dim)};
-    if (!new_db.initialize())
+    // Имя резервируется до индексации: одновременное создание БД с тем же именем
+    // не начнёт писать в тот же файл.
+    databases.reserve(filename);
+    try
     {
-        throw std::runtime_error("Failed to initialize database");
-    }
-    this->vector_database_list.push_back(new_db);
+        auto new_db = std::make_shared<VectorDatabase>(filename, static_cast<size_t>(resolveDimension()));
+        new_db->setMappingOptions(getMappingOptions());
+        new_db->setMemoryOptions(getMemoryOptions());
+        if (!new_db->initialize())
+        {
+            throw std::runtime_error("Failed to initialize database");
+        }
 
 #ifdef DEBUG
-    std::cout << "\ntype: " << type << std::endl;
+        std::cout << "\ntype: " << type << std::endl;
 #endif // DEBUG
 
-    for (auto file : files)
-    {
-        switch (type)
+        // БД наполняется до регистрации, поэтому запросы к другим БД
+        // не ждут окончания индексации.
+        for (const auto &file : files)
         {
-        case generatorType::chunk:
-            this->addDocument(file, BATCH, static_cast<int>(this->vector_database_list.size() - 1));
-            break;
-        case generatorType::paragraphs:
-            this->addDocumentByParagraphs(file, static_cast<int>(this->vector_database_list.size() - 1));
-            break;
-        default:
-            break;
+            indexDocument(file, type, BATCH, *new_db);
         }
+        new_db->save();
+
+        int id = databases.add(filename, new_db, true);
+        residency.use(new_db);
+        return id;
+    }
+    catch (...)
+    {
+        databases.release(filename);
+        throw;
     }
 }
 
@@ -235,26 +574,52 @@ void Rag::initDatabaseList()
     }
     for (const auto &entry : std::filesystem::directory_iterator(db_path))
     {
-        if (entry.is_regular_file())
+        // Временные файлы остаются после прерванного сохранения.
+        if (entry.is_regular_file() && entry.path().extension() != ".tmp")
         {
-            std::cout << entry.path() << std::endl;
-            vector_database_list.emplace_back(entry.path(), dim);
-            if (!vector_database_list.back().initialize())
+            // Читается только заголовок: данные загрузятся при первом запросе к БД.
+            size_t file_dim = 0;
+            size_t count = 0;
+            if (!VectorDatabase::readHeader(entry.path().string(), file_dim, count))
             {
-                vector_database_list.pop_back();
+                std::cerr << "Failed to read database header: " << entry.path() << std::endl;
+                continue;
+            }
+            learnDimension(file_dim);
+
+            auto name = entry.path().filename().string();
+            auto db = std::make_shared<VectorDatabase>(name, static_cast<size_t>(dim.load()));
+            db->setMappingOptions(getMappingOptions());
+            db->setMemoryOptions(getMemoryOptions());
+            if (db->attach())
+            {
+                std::cout << entry.path() << ": " << db->size() << " векторов" << std::endl;
+                databases.add(name, std::move(db));
             }
         }
     }
 }
 
-const std::vector<float> Rag::embedText(std::string text)
+const std::vector<float> Rag::embedText(std::string text, RequestPriority priority)
+{
+    // Ключ начинается с класса приоритета: вопрос пользователя не ждёт фоновый вызов
+    // с тем же текстом, допущенный с фоновым приоритетом.
+    std::string key(1, static_cast<char>(priority));
+    key += text;
+    return embed_calls.run(key, [&]() { return fetchEmbedding(text, priority); });
+}
+
+std::vector<float> Rag::fetchEmbedding(const std::string &text, RequestPriority priority)
 {
     std::cout << "Start embedding\n";
     nlohmann::json payload;
     payload["content"] = text;
-    cpr::Response r = cpr::Post(cpr::Url(embeder_address),
-                                cpr::Header{{"Content-Type", "application/json"}},
-                                cpr::Body{payload.dump()});
+
+    auto ticket = embedder_scheduler.admit(priority);
+    auto start = std::chrono::steady_clock::now();
+    cpr::Response r = embedder.post(payload.dump(), priority);
+    ticket.release(embeddingLoadLatency(millisecondsSince(start), text.size()), r.status_code == 200);
+
     if (r.status_code != 200)
     {
         throw std::runtime_error(r.error.message);
@@ -263,46 +628,483 @@ const std::vector<float> Rag::embedText(std::string text)
     try
     {
         auto response_json = nlohmann::json::parse(r.text);
-        std::vector<float> m;
+        if (!response_json.is_array() || response_json.empty())
+        {
+            std::cerr << response_json << std::endl;
+            throw std::runtime_error("Invalid response format: expected array of embeddings");
+        }
+        auto m = parseEmbedding(response_json[0], dim);
+        learnDimension(m.size());
+
+        std::cout << "finished embedding!\n" << m.data() << "\n" << std::endl;
+        return m;
+    }
+    catch (const nlohmann::json::exception &e)
+    {
+        throw std::runtime_error(std::string("JSON parse error: ") + e.what());
+    }
+}
+
+std::vector<std::vector<float>> Rag::embedBatch(const std::vector<std::string> &texts, RequestPriority priority)
+{
+    if (texts.empty())
+    {
+        return {};
+    }
 
-        if (response_json.is_array() && !response_json.empty() && response_json[0].contains("embedding") &&
-            response_json[0]["embedding"].is_array() && !response_json[0]["embedding"].empty() &&
-            response_json[0]["embedding"][0].is_array())
+    nlohmann::json payload;
+    payload["content"] = texts;
+
+    auto ticket = embedder_scheduler.admit(priority);
+    auto start = std::chrono::steady_clock::now();
+    cpr::Response r = embedder.post(payload.dump(), priority, false);
+    size_t bytes = 0;
+    for (const auto &text : texts)
+    {
+        bytes += std::max<size_t>(text.size(), EMBEDDING_LOAD_UNIT_BYTES);
+    }
+    ticket.release(embeddingLoadLatency(millisecondsSince(start), bytes), r.status_code == 200);
+
+    if (r.status_code != 200)
+    {
+        throw std::runtime_error(r.error.message);
+    }
+
+    try
+    {
+        auto response_json = nlohmann::json::parse(r.text);
+        if (!response_json.is_array() || response_json.size() != texts.size())
         {
-            for (const auto &val : response_json[0]["embedding"][0])
+            throw std::runtime_error("Invalid response format: expected " + std::to_string(texts.size()) +
+                                     " embeddings");
+        }
+
+        std::vector<std::vector<float>> result(texts.size());
+        for (size_t i = 0; i < response_json.size(); ++i)
+        {
+            const auto &item = response_json[i];
+            auto index = item.value("index", i);
+            if (index >= result.size())
+            {
+                throw std::runtime_error("Embedding index out of range: " + std::to_string(index));
+            }
+            result[index] = parseEmbedding(item, dim);
+            learnDimension(result[index].size());
+        }
+        return result;
+    }
+    catch (const nlohmann::json::exception &e)
+    {
+        throw std::runtime_error(std::string("JSON parse error: ") + e.what());
+    }
+}
+
+std::vector<std::shared_ptr<VectorDatabase>> Rag::get_vector_database_list() const
+{
+    std::vector<std::shared_ptr<VectorDatabase>> result;
+    for (auto &entry : databases.list())
+    {
+        result.push_back(std::move(entry.database));
+    }
+    return result;
+}
+
+std::vector<DatabaseEntry> Rag::listDatabases() const
+{
+    return databases.list();
+}
+
+std::shared_ptr<VectorDatabase> Rag::getDatabase(int database_id) const
+{
+    auto db = databases.find(database_id);
+    if (!db)
+    {
+        throw std::runtime_error("Unknown database id: " + std::to_string(database_id));
+    }
+    residency.use(db);
+    return db;
+}
+
+int Rag::findDatabaseId(const std::string &name) const
+{
+    return databases.idOf(name);
+}
+
+std::vector<DatabaseResidency> Rag::getDatabaseResidency() const
+{
+    std::vector<DatabaseResidency> result;
+    for (const auto &entry : databases.list())
+    {
+        result.push_back({entry.id,
+                          entry.name,
+                          entry.database->isResident(),
+                          entry.database->memoryUsage(),
+                          entry.database->size(),
+                          entry.database->loadProgress()});
+    }
+    return result;
+}
+
+void Rag::setDatabaseMemoryBudget(size_t bytes)
+{
+    residency.setBudget(bytes);
+}
+
+size_t Rag::getDatabaseMemoryBudget() const
+{
+    return residency.getBudget();
+}
+
+std::vector<BackendHealth> Rag::getBackendHealth() const
+{
+    return health.status();
+}
+
+bool Rag::backendsHealthy() const
+{
+    return health.healthy("model") && health.healthy("embedder");
+}
+
+void Rag::checkBackends()
+{
+    health.checkNow();
+}
+
+int Rag::getDimension() const
+{
+    return dim;
+}
+
+int Rag::resolveDimension()
+{
+    if (dim == 0)
+    {
+        learnDimension(embedText("Test text", RequestPriority::interactive).size());
+    }
+    return dim;
+}
+
+void Rag::learnDimension(size_t size)
+{
+    int expected = 0;
+    if (size > 0 && dim.compare_exchange_strong(expected, static_cast<int>(size)))
+    {
+        std::cerr << "dim is setted: " << size << std::endl;
+    }
+}
+
+void Rag::preloadDatabases()
+{
+    auto entries = databases.list();
+    entries.erase(std::remove_if(entries.begin(),
+                                 entries.end(),
+                                 [](const DatabaseEntry &entry) { return entry.database->isResident(); }),
+                  entries.end());
+    if (entries.empty())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(loading_mutex);
+    if (!database_loader)
+    {
+        // Параллельная загрузка файлов ограничена пропускной способностью диска, а не числом ядер.
+        database_loader = std::make_unique<ThreadPool>(
+            std::min<size_t>(entries.size(), std::max(1u, std::thread::hardware_concurrency())));
+    }
+
+    size_t total = entries.size();
+    databases_pending += total;
+    auto loaded = std::make_shared<std::atomic<size_t>>(0);
+    for (auto &entry : entries)
+    {
+        database_loader->submit(
+            [this, entry, total, loaded]()
             {
-                if (val.is_number())
+                // Память резервируется до загрузки: параллельные загрузки не превысят бюджет вместе.
+                size_t bytes = entry.database->estimatedMemoryUsage();
+                if (residency.reserve(bytes))
                 {
-                    m.push_back(val.get<float>());
+                    // Ошибка загрузки не должна оставить waitDatabasesReady ждать вечно:
+                    // БД загрузится при первом запросе или сообщит об ошибке ему.
+                    try
+                    {
+                        auto start = std::chrono::steady_clock::now();
+                        residency.use(entry.database);
+                        std::cout << "Загружена БД " << entry.name << " (" << ++*loaded << "/" << total << ") за "
+                                  << millisecondsSince(start) << " мс" << std::endl;
+                    }
+                    catch (const std::exception &e)
+                    {
+                        std::cerr << "Ошибка загрузки БД " << entry.name << ": " << e.what() << std::endl;
+                    }
+                    residency.release(bytes);
                 }
-                else
+
+                std::lock_guard<std::mutex> done_lock(loading_mutex);
+                if (--databases_pending == 0)
                 {
-                    throw std::runtime_error("Embedding value is not a number");
+                    loading_done.notify_all();
                 }
-            }
+            });
+    }
+}
+
+void Rag::setMappingOptions(const MappingOptions &options)
+{
+    std::lock_guard<std::mutex> lock(options_mutex);
+    mapping_options = options;
+    for (const auto &entry : databases.list())
+    {
+        auto database_options = options;
+        if (pinned_databases.count(entry.id))
+        {
+            database_options.lock = entry.database->getMappingOptions().lock;
         }
-        else
+        entry.database->setMappingOptions(database_options);
+    }
+}
+
+MappingOptions Rag::getMappingOptions() const
+{
+    std::lock_guard<std::mutex> lock(options_mutex);
+    return mapping_options;
+}
+
+void Rag::setMemoryOptions(const MemoryOptions &options)
+{
+    {
+        std::lock_guard<std::mutex> lock(options_mutex);
+        memory_options = options;
+    }
+    for (const auto &entry : databases.list())
+    {
+        entry.database->setMemoryOptions(options);
+    }
+}
+
+MemoryOptions Rag::getMemoryOptions() const
+{
+    std::lock_guard<std::mutex> lock(options_mutex);
+    return memory_options;
+}
+
+bool Rag::pinDatabase(int database_id, bool pinned)
+{
+    auto db = getDatabase(database_id);
+    std::lock_guard<std::mutex> lock(options_mutex);
+    pinned_databases.insert(database_id);
+    return db->setLocked(pinned);
+}
+
+bool Rag::compressDatabase(int database_id, bool enabled)
+{
+    auto db = getDatabase(database_id);
+    db->setEmbeddingCompression(enabled);
+    return db->save();
+}
+
+void Rag::warmUpDatabase(int database_id, bool wait)
+{
+    getDatabase(database_id)->warmUp(wait);
+}
+
+bool Rag::databasesReady() const
+{
+    return databases_pending == 0;
+}
+
+bool Rag::waitDatabasesReady(double timeout_seconds)
+{
+    std::unique_lock<std::mutex> lock(loading_mutex);
+    auto ready = [this]() { return databases_pending == 0; };
+    if (timeout_seconds < 0)
+    {
+        loading_done.wait(lock, ready);
+        return true;
+    }
+    return loading_done.wait_for(lock, std::chrono::duration<double>(timeout_seconds), ready);
+}
+
+std::vector<size_t> Rag::countTokens(const std::vector<std::string> &texts)
+{
+    // /tokenize не занимает слот генерации, поэтому не проходит через model_scheduler:
+    // иначе подсчёт токенов ждал бы окончания чужих ответов. Запросы идут скользящим окном
+    // из TOKENIZE_MAX_IN_FLIGHT, чтобы один вопрос не открывал сотни соединений к серверу.
+    std::vector<cpr::AsyncResponse> responses;
+    responses.reserve(texts.size());
+    auto send = [&](const std::string &text)
+    {
+        nlohmann::json payload;
+        payload["content"] = text;
+        responses.push_back(cpr::PostAsync(tokenizer_address,
+                                           cpr::Header{{"Content-Type", "application/json"}},
+                                           cpr::Body{payload.dump()},
+                                           cpr::Timeout{TOKENIZE_TIMEOUT_MS}));
+    };
+    for (size_t i = 0; i < texts.size() && i < TOKENIZE_MAX_IN_FLIGHT; ++i)
+    {
+        send(texts[i]);
+    }
+
+    std::vector<size_t> counts;
+    counts.reserve(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        cpr::Response r = responses[i].get();
+        if (i + TOKENIZE_MAX_IN_FLIGHT < texts.size())
         {
-            std::cerr << response_json << std::endl;
-            throw std::runtime_error("Invalid response format: expected array of embeddings");
+            send(texts[i + TOKENIZE_MAX_IN_FLIGHT]);
         }
+        size_t count = ContextPacker::estimateTokens(texts[i]);
+        if (r.status_code == 200)
+        {
+            try
+            {
+                auto response_json = nlohmann::json::parse(r.text);
+                if (response_json.contains("tokens") && response_json["tokens"].is_array())
+                {
+                    count = response_json["tokens"].size();
+                }
+            }
+            catch (const nlohmann::json::exception &e)
+            {
+            }
+        }
+        counts.push_back(count);
+    }
+    return counts;
+}
+
+std::vector<std::vector<float>> Rag::embedTexts(const std::vector<std::string> &texts)
+{
+    // Реальное количество запросов в обработке определяют embedder_scheduler и embedder_limiter.
+    std::call_once(embedding_workers_created,
+                   [this]() { embedding_workers = std::make_unique<ThreadPool>(embedder_limiter.maxLimit()); });
+
+    // После первой ошибки оставшиеся тексты документа не отправляются.
+    std::atomic<bool> failed{false};
+    std::vector<std::future<std::vector<float>>> pending;
+    pending.reserve(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        pending.push_back(embedding_workers->submit(
+            [this, &texts, &failed, i]() -> std::vector<float>
+            {
+                if (failed)
+                {
+                    return {};
+                }
+                try
+                {
+                    return embedText(texts[i], RequestPriority::background);
+                }
+                catch (...)
+                {
+                    failed = true;
+                    throw;
+                }
+            }));
+    }
 
-        if (m.size() != this->dim && dim > 0)
+    // Дожидаемся всех задач: они ссылаются на texts и failed.
+    std::vector<std::vector<float>> result(texts.size());
+    std::exception_ptr error;
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+        try
         {
-            throw std::runtime_error("Embedder returned vector with wrong size: " + std::to_string(m.size()) +
-                                     ". Expected: " + std::to_string(this->dim));
+            result[i] = pending[i].get();
         }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
 
-        std::cout << "finished embedding!\n" << m.data() << "\n" << std::endl;
-        return m;
+    if (error)
+    {
+        std::rethrow_exception(error);
     }
-    catch (const nlohmann::json::exception &e)
+    return result;
+}
+
+void Rag::setHedging(bool enabled, double percentile)
+{
+    embedder.setHedging(enabled, percentile);
+}
+
+void Rag::setEmbedderReplicas(std::vector<std::string> urls)
+{
+    std::vector<cpr::Url> replicas;
+    for (auto &url : urls)
     {
-        throw std::runtime_error(std::string("JSON parse error: ") + e.what());
+        replicas.emplace_back(url);
     }
+    embedder.setReplicas(std::move(replicas));
+}
+
+HedgeStats Rag::getHedgeStats() const
+{
+    return embedder.stats();
+}
+
+LimiterStats Rag::getEmbedderLimiterStats() const
+{
+    return embedder_limiter.stats();
+}
+
+LimiterStats Rag::getModelLimiterStats() const
+{
+    return model_limiter.stats();
+}
+
+void Rag::setPriorityLimits(RequestPriority priority, size_t reserved, double rate_limit)
+{
+    embedder_scheduler.configure(priority, reserved, rate_limit);
+    model_scheduler.configure(priority, reserved, rate_limit);
+}
+
+PriorityClassStats Rag::getEmbedderSchedulerStats(RequestPriority priority) const
+{
+    return embedder_scheduler.stats(priority);
+}
+
+PriorityClassStats Rag::getModelSchedulerStats(RequestPriority priority) const
+{
+    return model_scheduler.stats(priority);
+}
+
+uint64_t Rag::getCoalescedEmbeddings() const
+{
+    return embed_calls.sharedCalls();
+}
+
+void Rag::setContextTokenBudget(size_t budget)
+{
+    context_token_budget = budget;
+}
+
+void Rag::setContextCompression(bool enabled, size_t token_budget)
+{
+    compression_token_budget = token_budget;
+    compression_enabled = enabled;
+}
+
+void Rag::setSourceReferences(bool enabled)
+{
+    source_references = enabled;
+}
+
+bool Rag::getSourceReferences() const
+{
+    return source_references;
 }
 
-const std::vector<VectorDatabase> &Rag::get_vector_database_list() const
+std::vector<SourceDocument> Rag::checkSources()
 {
-    return vector_database_list;
+    return sources.check();
 }
@@ -1,11 +1,46 @@
 #pragma once
+#include "concurrency_limiter.hpp"
+#include "context_compressor.hpp"
+#include "context_packer.hpp"
 #include "cpr/cprtypes.h"
+#include "database_registry.hpp"
+#include "health_monitor.hpp"
+#include "hedged_request.hpp"
+#include "request_scheduler.hpp"
+#include "residency_manager.hpp"
+#include "single_flight.hpp"
+#include "source_store.hpp"
+#include "thread_pool.hpp"
 #include "vector_db.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 const static cpr::Url model_address{"http://100.124.183.1:10101/completion"};
 const static cpr::Url embeder_address("http://100.124.183.1:10100/embedding");
+const static cpr::Url tokenizer_address{"http://100.124.183.1:10101/tokenize"};
+
+/// Бюджет памяти для загруженных БД по умолчанию (0 - без ограничения).
+#define DATABASE_MEMORY_BUDGET 0
+/// Отображать файлы БД в память (mmap) по умолчанию.
+#define DATABASE_MMAP false
+/// Период фоновой проверки доступности серверов (мс).
+#define HEALTH_CHECK_INTERVAL_MS 10000
+/// Хранить в БД ссылки на фрагменты исходных файлов вместо их текста по умолчанию.
+#define SOURCE_REFERENCES false
+/// Индекс исходных документов, на которые ссылаются БД.
+#define SOURCE_INDEX_PATH "./sources.idx"
+/// Таймаут запроса к токенизатору (мс); после него используется оценка количества токенов.
+#define TOKENIZE_TIMEOUT_MS 2000
+/// Наибольшее количество одновременных запросов к токенизатору от одного вызова countTokens.
+#define TOKENIZE_MAX_IN_FLIGHT 8
 
 enum generatorType{
     chunk,
@@ -16,20 +51,120 @@ class Rag
 {
 
     /**
-   * @brief Список хранящий все векторные БД.
+   * @brief Реестр векторных БД.
+   *
+   * БД хранятся по shared_ptr: Python и запросы получают ссылки на те же объекты без копирования,
+   * а регистрация новой БД не останавливает уже идущие запросы.
+   */
+    DatabaseRegistry databases;
+
+    /**
+   * @brief Загрузка БД по требованию и выгрузка давно не использованных при нехватке памяти.
+   *
+   * При запуске БД подключаются только по заголовку файла и загружаются при первом запросе.
+   */
+    mutable ResidencyManager residency{DATABASE_MEMORY_BUDGET};
+
+    /**
+   * @brief Параметры отображения файлов и размещения в памяти для регистрируемых БД.
+   */
+    MappingOptions mapping_options;
+    MemoryOptions memory_options;
+    std::unordered_set<int> pinned_databases; ///< БД, закрепление которых задано через pinDatabase().
+    mutable std::mutex options_mutex;
+
+    /**
+   * @brief Размерность эмбеддингов (0 - ещё неизвестна).
+   *
+   * Берётся из конфигурации или заголовков файлов БД; если БД нет, определяется
+   * по первому ответу эмбедера.
+   */
+    std::atomic<int> dim{0};
+
+    /**
+   * @brief Исходные документы и режим хранения фрагментов ссылками на них.
+   *
+   * В режиме ссылок метаданные строки - документ, смещение, длина и хеш фрагмента,
+   * а текст читается из отображённого в память файла при сборке промпта.
+   */
+    SourceStore sources{SOURCE_INDEX_PATH};
+    std::atomic<bool> source_references{SOURCE_REFERENCES};
+
+    /**
+   * @brief Фоновая проверка доступности модели и эмбедера.
    */
-    std::vector<VectorDatabase> vector_database_list;
+    HealthMonitor health{{{"model", model_address}, {"embedder", embeder_address}},
+                         std::chrono::milliseconds(HEALTH_CHECK_INTERVAL_MS)};
 
-    int dim = 0;
+    /**
+   * @brief Адаптивные ограничители параллельных запросов к эмбедеру и модели.
+   */
+    ConcurrencyLimiter embedder_limiter{4, 1, 64};
+    ConcurrencyLimiter model_limiter{2, 1, 16};
+
+    /**
+   * @brief Планировщики допуска запросов: интерактивные запросы проходят раньше индексации.
+   */
+    RequestScheduler embedder_scheduler{embedder_limiter};
+    RequestScheduler model_scheduler{model_limiter};
+
+    /**
+   * @brief Клиент эмбедера с поддержкой хеджирования запросов.
+   */
+    HedgedPoster embedder{{embeder_address}, embedder_scheduler};
+
+    /**
+   * @brief Объединение одновременных запросов эмбеддинга одного и того же текста.
+   *
+   * Объединяются только запросы одного класса приоритета (ключ - приоритет и текст).
+   */
+    SingleFlight<std::string, std::vector<float>> embed_calls;
+
+    /**
+   * @brief Сборщик контекста и его бюджет в токенах (0 - без ограничения).
+   */
+    ContextPacker context_packer{[this](const std::vector<std::string> &texts) { return countTokens(texts); }};
+    std::atomic<size_t> context_token_budget{2048};
+
+    /**
+   * @brief Экстрактивное сжатие контекста (по умолчанию выключено) и его бюджет в токенах.
+   */
+    ContextCompressor context_compressor{[this](const std::vector<std::string> &texts)
+                                         { return embedBatch(texts, RequestPriority::interactive); },
+                                         [this](const std::vector<std::string> &texts) { return countTokens(texts); }};
+    std::atomic<bool> compression_enabled{false};
+    std::atomic<size_t> compression_token_budget{512};
+
+    /**
+   * @brief Фоновая загрузка БД: число ещё не загруженных БД и сигнал о завершении.
+   *
+   * Пул объявлен последним: при уничтожении Rag он дожидается задач раньше, чем
+   * уничтожаются используемые ими поля.
+   */
+    std::atomic<size_t> databases_pending{0};
+    std::mutex loading_mutex;
+    std::condition_variable loading_done;
+    std::unique_ptr<ThreadPool> database_loader;
+
+    /**
+   * @brief Общий для всех вызовов embedTexts пул запросов эмбеддинга документов.
+   *
+   * Создаётся при первой индексации; потоков столько, сколько допускает максимальный лимит
+   * embedder_limiter, так что одновременная индексация нескольких документов не умножает потоки.
+   */
+    std::once_flag embedding_workers_created;
+    std::unique_ptr<ThreadPool> embedding_workers;
 
 public:
     /**
-   * @brief Проверка доступа к сервера модели и эмбедера. Инициализация баз
-   * @param dim - размерность векторов в БД.
-   * данных.
+   * @brief Регистрация баз данных и запуск фоновых проверок модели и эмбедера.
+   *
+   * Конструктор не обращается к серверам: доступность проверяется в фоне
+   * (getBackendHealth), а БД начинают обслуживаться сразу.
    *
+   * @param dim - размерность векторов в БД (0 - взять из файлов БД или из первого ответа эмбедера).
    */
-    Rag(/*int dim*/);
+    explicit Rag(int dim = 0);
 
     /**
    * @brief Функция для запроса ответа у модели.
@@ -39,6 +174,7 @@ public:
    * @param n_predict - максимальное количество токенов в ответе
    * @param temperature - температура выборки (влияет на креативность ответа)
    * @param top_k - количество наиболее вероятных токенов для ограничения выборки
+   * @param id_slot - слот llama-server, за которым закреплён диалог (-1 - любой свободный)
    * @return std::string - ответ
    */
     std::string request(std::string question,
@@ -47,7 +183,35 @@ public:
                         float temperature = 0.5,
                         int top_k = 1,
                         int rag_k = 3,
-                        float rag_sim_threshold = 0.3f);
+                        float rag_sim_threshold = 0.3f,
+                        int id_slot = -1);
+
+    /**
+   * @brief Потоковый запрос ответа у модели.
+   *
+   * Ответ читается из потока SSE llama-server, каждый полученный фрагмент сразу
+   * передаётся в on_token. Если on_token бросает исключение, генерация прерывается
+   * и исключение пробрасывается дальше.
+   *
+   * @param question - вопрос
+   * @param database_id_list - список идентификаторов баз данных для поиска контекста
+   * @param on_token - обработчик очередного фрагмента ответа
+   * @param n_predict - максимальное количество токенов в ответе
+   * @param temperature - температура выборки (влияет на креативность ответа)
+   * @param top_k - количество наиболее вероятных токенов для ограничения выборки
+   * @param id_slot - слот llama-server, за которым закреплён диалог (-1 - любой свободный)
+   * @return std::string - полный ответ
+   * @throws std::runtime_error, если сервер модели ответил ошибкой или недоступен
+   */
+    std::string requestStream(std::string question,
+                              std::vector<int> database_id_list,
+                              std::function<void(const std::string &)> on_token,
+                              int n_predict = 500,
+                              float temperature = 0.5,
+                              int top_k = 1,
+                              int rag_k = 3,
+                              float rag_sim_threshold = 0.3f,
+                              int id_slot = -1);
 
     /**
    * @brief Добавляет документ в БД.
@@ -73,26 +237,396 @@ public:
    * @param filename - название файла БД
    * @param dim - размерность БД
    * @param files - файлы которые должны быть добавлены в БД
+   * @return int - идентификатор новой БД
    */
-    void createDatabase(std::string filename, std::vector<std::string> files, generatorType type);
+    int createDatabase(std::string filename, std::vector<std::string> files, generatorType type);
+
+    /**
+     * @brief Получить список векторных БД.
+     *
+     * Возвращается список указателей в порядке идентификаторов. Сами БД не копируются.
+     *
+     * @return std::vector<std::shared_ptr<VectorDatabase>>
+     */
+    std::vector<std::shared_ptr<VectorDatabase>> get_vector_database_list() const;
+
+    /**
+     * @brief Зарегистрированные БД с идентификаторами и именами.
+     *
+     * Идентификаторы постоянны: их можно хранить и передавать в request.
+     *
+     * @return std::vector<DatabaseEntry>
+     */
+    std::vector<DatabaseEntry> listDatabases() const;
+
+    /**
+     * @brief БД по идентификатору.
+     *
+     * @param database_id - идентификатор БД
+     * @return std::shared_ptr<VectorDatabase>
+     * @throws std::runtime_error, если БД не найдена
+     */
+    std::shared_ptr<VectorDatabase> getDatabase(int database_id) const;
+
+    /**
+     * @brief Идентификатор БД по имени.
+     *
+     * @param name - имя БД
+     * @return int - идентификатор или -1, если БД не найдена
+     */
+    int findDatabaseId(const std::string &name) const;
+
+    /**
+     * @brief Состояние зарегистрированных БД в памяти.
+     *
+     * Не загружает выгруженные БД.
+     *
+     * @return std::vector<DatabaseResidency>
+     */
+    std::vector<DatabaseResidency> getDatabaseResidency() const;
+
+    /**
+     * @brief Бюджет памяти для загруженных БД.
+     *
+     * При превышении бюджета выгружаются давно не использованные БД; БД, к которой идёт
+     * обращение, остаётся загруженной даже если одна не помещается в бюджет.
+     *
+     * @param bytes - бюджет в байтах (0 - без ограничения)
+     */
+    void setDatabaseMemoryBudget(size_t bytes);
+    size_t getDatabaseMemoryBudget() const;
+
+    /**
+     * @brief Фоновая загрузка всех выгруженных БД в пуле потоков.
+     *
+     * Не вызывается автоматически: без неё БД загружаются при первом запросе.
+     * Файлы загружаются параллельно, большие файлы - параллельно по частям. Под каждую БД
+     * заранее резервируется оценка её памяти; БД, не помещающиеся в бюджет, загрузятся
+     * при первом запросе. Ход загрузки виден в getDatabaseResidency, завершение - в databasesReady.
+     */
+    void preloadDatabases();
+
+    /**
+     * @brief Параметры отображения файлов БД в память (mmap, MAP_POPULATE, огромные страницы, mlock).
+     *
+     * Применяются ко всем зарегистрированным и новым БД; загруженные БД переходят в новый
+     * режим при следующей загрузке. Многоуровневый режим (tiered) держит в памяти только
+     * int8-копию эмбеддингов, что позволяет обслуживать БД больше объёма памяти; бюджет
+     * памяти учитывает копию и кэш горячих строк. Закрепление (lock) не меняется у БД,
+     * для которых оно задано через pinDatabase().
+     */
+    void setMappingOptions(const MappingOptions &options);
+    MappingOptions getMappingOptions() const;
+
+    /**
+     * @brief Закрепить страницы горячей БД в памяти (mlock) или снять закрепление.
+     *
+     * Закреплённая БД также не выгружается по бюджету памяти, пока загружена. Заданное здесь
+     * состояние сохраняется при последующих вызовах setMappingOptions().
+     *
+     * @param database_id - идентификатор БД
+     * @return true, если состояние изменено
+     */
+    bool pinDatabase(int database_id, bool pinned);
+
+    /**
+     * @brief Размещение матриц эмбеддингов (огромные страницы, распределение по узлам NUMA).
+     *
+     * Применяется ко всем зарегистрированным и новым БД; действует на сегменты,
+     * выделенные после вызова, поэтому загруженные БД переходят на него после
+     * перезагрузки или уплотнения.
+     */
+    void setMemoryOptions(const MemoryOptions &options);
+    MemoryOptions getMemoryOptions() const;
+
+    /**
+     * @brief Хранить эмбеддинги БД сжатыми без потерь (для архивных, редко используемых БД).
+     *
+     * Файл сразу перезаписывается в выбранном формате; сжатая БД загружается в кучу
+     * с параллельной распаковкой, результаты поиска не меняются.
+     *
+     * @param database_id - идентификатор БД
+     * @param enabled - сжимать эмбеддинги
+     * @return true, если файл сохранён
+     */
+    bool compressDatabase(int database_id, bool enabled);
+
+    /**
+     * @brief Прогрев страниц отображённой БД в фоне.
+     *
+     * @param database_id - идентификатор БД
+     * @param wait - дождаться окончания прогрева
+     */
+    void warmUpDatabase(int database_id, bool wait = false);
+
+    /**
+     * @brief Завершена ли фоновая загрузка БД.
+     */
+    bool databasesReady() const;
+
+    /**
+     * @brief Ожидание завершения фоновой загрузки БД.
+     *
+     * @param timeout_seconds - время ожидания (отрицательное - без ограничения)
+     * @return true, если загрузка завершена
+     */
+    bool waitDatabasesReady(double timeout_seconds = -1);
 
     /**
-     * @brief Получить массив std::vector<VectorDatabase>
+     * @brief Результаты последних проверок доступности модели и эмбедера.
      *
-     * @return std::vector<VectorDatabase>
+     * Не ждёт сети.
+     *
+     * @return std::vector<BackendHealth>
+     */
+    std::vector<BackendHealth> getBackendHealth() const;
+
+    /**
+     * @brief Отвечали ли модель и эмбедер на последнюю проверку.
+     */
+    bool backendsHealthy() const;
+
+    /**
+     * @brief Внеочередная проверка доступности серверов.
+     */
+    void checkBackends();
+
+    /**
+     * @brief Размерность эмбеддингов (0 - ещё неизвестна).
+     */
+    int getDimension() const;
+
+    /**
+     * @brief Настройка хеджирования запросов к эмбедеру.
+     *
+     * Если эмбеддинг вопроса не получен за время, равное перцентилю недавних задержек,
+     * дублирующий запрос отправляется на следующую реплику эмбедера.
+     *
+     * @param enabled - включить хеджирование
+     * @param percentile - перцентиль задержки (0..1), после которого отправляется дубликат
+     */
+    void setHedging(bool enabled, double percentile = 0.95);
+
+    /**
+     * @brief Задать список реплик эмбедера.
+     *
+     * @param urls - адреса реплик, первая считается основной
+     */
+    void setEmbedderReplicas(std::vector<std::string> urls);
+
+    /**
+     * @brief Счётчики отправленных и выигравших дублирующих запросов.
+     *
+     * @return HedgeStats
+     */
+    HedgeStats getHedgeStats() const;
+
+    /**
+     * @brief Состояние ограничителя параллельных запросов к эмбедеру.
+     *
+     * @return LimiterStats
+     */
+    LimiterStats getEmbedderLimiterStats() const;
+
+    /**
+     * @brief Состояние ограничителя параллельных запросов к модели.
+     *
+     * @return LimiterStats
+     */
+    LimiterStats getModelLimiterStats() const;
+
+    /**
+     * @brief Настройка класса приоритета для запросов к эмбедеру и модели.
+     *
+     * @param priority - класс приоритета
+     * @param reserved - количество слотов, зарезервированных за классом
+     * @param rate_limit - максимальное количество запросов в секунду (0 - без ограничения)
+     */
+    void setPriorityLimits(RequestPriority priority, size_t reserved, double rate_limit);
+
+    /**
+     * @brief Состояние очереди запросов к эмбедеру для класса приоритета.
+     *
+     * @param priority - класс приоритета
+     * @return PriorityClassStats
+     */
+    PriorityClassStats getEmbedderSchedulerStats(RequestPriority priority) const;
+
+    /**
+     * @brief Состояние очереди запросов к модели для класса приоритета.
+     *
+     * @param priority - класс приоритета
+     * @return PriorityClassStats
+     */
+    PriorityClassStats getModelSchedulerStats(RequestPriority priority) const;
+
+    /**
+     * @brief Сколько вызовов эмбеддинга получили результат уже выполнявшегося запроса того же текста.
+     *
+     * @return uint64_t
+     */
+    uint64_t getCoalescedEmbeddings() const;
+
+    /**
+     * @brief Задать бюджет контекста в токенах.
+     *
+     * Найденные фрагменты отбираются по убыванию сходства, пока помещаются в бюджет.
+     *
+     * @param budget - максимальное количество токенов контекста (0 - без ограничения)
+     */
+    void setContextTokenBudget(size_t budget);
+
+    /**
+     * @brief Настройка экстрактивного сжатия контекста.
+     *
+     * Отобранные фрагменты разбиваются на предложения, и в промпт попадают только
+     * наиболее близкие к вопросу предложения в пределах бюджета.
+     *
+     * @param enabled - включить сжатие
+     * @param token_budget - максимальное количество токенов сжатого контекста
+     */
+    void setContextCompression(bool enabled, size_t token_budget = 512);
+
+    /**
+     * @brief Хранить новые фрагменты ссылками на исходные файлы вместо копий текста.
+     *
+     * Файлы БД и память занимают в основном векторы; исходные файлы должны оставаться
+     * на месте. Фрагменты изменённых после индексации файлов не попадают в контекст.
+     * Уже записанные фрагменты читаются в любом режиме.
+     *
+     * @param enabled - включить режим ссылок
+     */
+    void setSourceReferences(bool enabled);
+    bool getSourceReferences() const;
+
+    /**
+     * @brief Проверка исходных документов, на которые ссылаются БД.
+     *
+     * @return std::vector<SourceDocument> - документы с признаком изменения
      */
-    const std::vector<VectorDatabase> &get_vector_database_list() const;
+    std::vector<SourceDocument> checkSources();
 
 private:
     /**
-   * @brief Заполнение vector_database_list.
+   * @brief Сборка промпта: поиск контекста в выбранных БД и оформление в шаблон чата.
+   *
+   * Промпт собирается так, чтобы llama-server мог переиспользовать KV-кэш: сначала
+   * неизменный системный промпт, затем контекст в детерминированном порядке, в конце вопрос.
+   * Контекст отбирается context_packer в пределах context_token_budget и при
+   * включённом сжатии сокращается context_compressor.
+   *
+   * @param question - вопрос
+   * @param database_id_list - список идентификаторов баз данных для поиска контекста
+   * @return std::string - промпт для модели
+   */
+    std::string buildPrompt(const std::string &question,
+                            const std::vector<int> &database_id_list,
+                            int rag_k,
+                            float rag_sim_threshold);
+
+    /**
+   * @brief Разбиение файла на фрагменты, получение их векторов и запись в БД.
+   *
+   * В режиме ссылок файл регистрируется в sources, а в метаданные записываются ссылки.
+   *
+   * @param filename - название файла
+   * @param type - способ разбиения
+   * @param batch_size - длина фрагмента для generatorType::chunk
+   * @param db - БД
+   */
+    void indexDocument(const std::string &filename, generatorType type, int batch_size, VectorDatabase &db);
+
+    /**
+   * @brief Текст фрагмента по метаданным: сами метаданные или текст по ссылке.
+   *
+   * Для ссылки заполняются также документ и смещение фрагмента в нём.
+   *
+   * @param metadata - метаданные строки
+   * @param candidate - фрагмент, в который записывается текст
+   * @return false, если источник ссылки изменён или недоступен
+   */
+    bool chunkText(std::string_view metadata, ContextCandidate &candidate);
+
+    /**
+   * @brief Разбиение текста на фрагменты фиксированной длины (в символах UTF-8).
+   *
+   * @param content - текст
+   * @param batch_size - длина фрагмента
+   * @return std::vector<std::pair<size_t, size_t>> - смещения и длины фрагментов (байты)
+   */
+    static std::vector<std::pair<size_t, size_t>> splitChunks(const std::string &content, int batch_size);
+
+    /**
+   * @brief Разбиение текста на параграфы по пустым строкам.
+   *
+   * @param content - текст
+   * @return std::vector<std::pair<size_t, size_t>> - смещения и длины параграфов (байты)
+   */
+    static std::vector<std::pair<size_t, size_t>> splitParagraphs(const std::string &content);
+
+    /**
+   * @brief Регистрация БД из каталога ./db.
    */
     void initDatabaseList();
+
+    /**
+   * @brief Размерность эмбеддингов; если она неизвестна, определяется запросом к эмбедеру.
+   */
+    int resolveDimension();
+
+    /**
+   * @brief Запомнить размерность по полученному эмбеддингу, если она ещё неизвестна.
+   */
+    void learnDimension(size_t size);
     /**
    * @brief Получить вектор для куска текста.
    *
+   * Одновременные вызовы с одинаковым текстом выполняют один запрос к эмбедеру.
+   *
    * @param text - текст
+   * @param priority - класс приоритета запроса (интерактивные запросы могут хеджироваться)
    * @return const std::vector<float> - вектор
    */
-    const std::vector<float> embedText(std::string text);
+    const std::vector<float> embedText(std::string text, RequestPriority priority = RequestPriority::background);
+
+    /**
+   * @brief Получить векторы для набора текстов.
+   *
+   * Запросы выполняются параллельно в пуле embedding_workers с фоновым приоритетом,
+   * их количество в обработке регулируют embedder_scheduler и embedder_limiter.
+   *
+   * @param texts - тексты
+   * @return std::vector<std::vector<float>> - векторы в порядке текстов
+   */
+    std::vector<std::vector<float>> embedTexts(const std::vector<std::string> &texts);
+
+    /**
+   * @brief Запрос вектора у эмбедера без объединения вызовов.
+   *
+   * @param text - текст
+   * @param priority - класс приоритета запроса
+   * @return std::vector<float> - вектор
+   */
+    std::vector<float> fetchEmbedding(const std::string &text, RequestPriority priority);
+
+    /**
+   * @brief Получить векторы для набора текстов одним запросом к эмбедеру.
+   *
+   * @param texts - тексты
+   * @param priority - класс приоритета запроса
+   * @return std::vector<std::vector<float>> - векторы в порядке текстов
+   */
+    std::vector<std::vector<float>> embedBatch(const std::vector<std::string> &texts, RequestPriority priority);
+
+    /**
+   * @brief Количество токенов каждого из текстов по токенизатору модели.
+   *
+   * Каждый текст - отдельный запрос /tokenize с таймаутом TOKENIZE_TIMEOUT_MS; одновременно
+   * отправляется не больше TOKENIZE_MAX_IN_FLIGHT запросов. Для текста, на который сервер
+   * не ответил вовремя, возвращается оценка ContextPacker::estimateTokens.
+   *
+   * @param texts - тексты
+   * @return std::vector<size_t> - количество токенов в порядке текстов
+   */
+    std::vector<size_t> countTokens(const std::vector<std::string> &texts);
 };
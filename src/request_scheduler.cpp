@@ -0,0 +1,189 @@
+#include "request_scheduler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+RequestScheduler::Ticket::Ticket(RequestScheduler *owner, RequestPriority priority, ConcurrencyLimiter::Permit permit)
+    : owner(owner), priority(priority), permit(std::move(permit))
+{
+}
+
+RequestScheduler::Ticket::Ticket(Ticket &&other) noexcept
+    : owner(other.owner), priority(other.priority), permit(std::move(other.permit))
+{
+    other.owner = nullptr;
+}
+
+RequestScheduler::Ticket::~Ticket()
+{
+    if (owner)
+    {
+        permit.release(0.0, false);
+        owner->onRelease(priority);
+    }
+}
+
+void RequestScheduler::Ticket::release(double latency_ms, bool ok)
+{
+    if (owner)
+    {
+        permit.release(latency_ms, ok);
+        owner->onRelease(priority);
+        owner = nullptr;
+    }
+}
+
+RequestScheduler::RequestScheduler(ConcurrencyLimiter &limiter) : limiter(limiter)
+{
+}
+
+RequestScheduler::Ticket RequestScheduler::admit(RequestPriority priority)
+{
+    auto index = static_cast<size_t>(priority);
+    std::unique_lock<std::mutex> lock(mutex);
+    auto &cls = classes[index];
+    ++cls.stats.waiting;
+
+    while (true)
+    {
+        auto retry_at = std::chrono::steady_clock::time_point::max();
+        if (canAdmit(index, retry_at))
+        {
+            // Слот ограничителя занимается под той же блокировкой, что и решение о приоритете:
+            // фоновый запрос не может перехватить его у допущенного интерактивного.
+            if (auto ticket = take(index))
+            {
+                --cls.stats.waiting;
+                lock.unlock();
+                // Допущенный приоритетный запрос больше не ждёт и мог разблокировать фоновые.
+                changed.notify_all();
+                return std::move(*ticket);
+            }
+        }
+        // Слоты освобождаются только через Ticket, который будит ожидающих; лимит растёт
+        // только при освобождении слота. По времени ждут только токены ограничения частоты.
+        if (retry_at == std::chrono::steady_clock::time_point::max())
+        {
+            changed.wait(lock);
+        }
+        else
+        {
+            changed.wait_until(lock, retry_at);
+        }
+    }
+}
+
+std::optional<RequestScheduler::Ticket> RequestScheduler::tryAdmit(RequestPriority priority)
+{
+    auto index = static_cast<size_t>(priority);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto retry_at = std::chrono::steady_clock::time_point::max();
+    if (classes[index].stats.waiting > 0 || !canAdmit(index, retry_at))
+    {
+        return std::nullopt;
+    }
+    return take(index);
+}
+
+std::optional<RequestScheduler::Ticket> RequestScheduler::take(size_t index)
+{
+    auto permit = limiter.tryAcquire();
+    if (!permit)
+    {
+        return std::nullopt;
+    }
+    auto &cls = classes[index];
+    ++cls.stats.in_flight;
+    ++cls.stats.admitted;
+    if (cls.rate_limit > 0)
+    {
+        cls.tokens -= 1.0;
+    }
+    return Ticket(this, static_cast<RequestPriority>(index), std::move(*permit));
+}
+
+void RequestScheduler::configure(RequestPriority priority, size_t reserved, double rate_limit)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &cls = classes[static_cast<size_t>(priority)];
+        cls.reserved = reserved;
+        cls.rate_limit = std::max(0.0, rate_limit);
+        cls.tokens = std::max(1.0, cls.rate_limit);
+        cls.refilled = std::chrono::steady_clock::now();
+    }
+    changed.notify_all();
+}
+
+PriorityClassStats RequestScheduler::stats(RequestPriority priority) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return classes[static_cast<size_t>(priority)].stats;
+}
+
+bool RequestScheduler::canAdmit(size_t index, std::chrono::steady_clock::time_point &retry_at)
+{
+    auto now = std::chrono::steady_clock::now();
+    auto has_token = [&now](PriorityClass &cls, std::chrono::steady_clock::time_point *when)
+    {
+        if (cls.rate_limit <= 0)
+        {
+            return true;
+        }
+        // Token bucket с ёмкостью в одну секунду запросов.
+        double elapsed = std::chrono::duration<double>(now - cls.refilled).count();
+        cls.tokens = std::min(std::max(1.0, cls.rate_limit), cls.tokens + elapsed * cls.rate_limit);
+        cls.refilled = now;
+        if (cls.tokens >= 1.0)
+        {
+            return true;
+        }
+        if (when)
+        {
+            *when = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                              std::chrono::duration<double>((1.0 - cls.tokens) / cls.rate_limit));
+        }
+        return false;
+    };
+
+    if (!has_token(classes[index], &retry_at))
+    {
+        return false;
+    }
+
+    // Более приоритетный класс с готовыми к допуску запросами проходит первым.
+    for (size_t i = 0; i < index; ++i)
+    {
+        if (classes[i].stats.waiting > 0 && has_token(classes[i], nullptr))
+        {
+            return false;
+        }
+    }
+
+    auto limit = limiter.stats().limit;
+    size_t in_flight = 0;
+    size_t reserved_for_others = 0;
+    for (size_t i = 0; i < n_classes; ++i)
+    {
+        in_flight += classes[i].stats.in_flight;
+        if (i != index && classes[i].reserved > classes[i].stats.in_flight)
+        {
+            reserved_for_others += classes[i].reserved - classes[i].stats.in_flight;
+        }
+    }
+    // Резерв не может отнять у класса последний слот, иначе при минимальном лимите
+    // фоновые запросы не выполнятся никогда.
+    auto usable = std::max(1.0, std::ceil(limit));
+    reserved_for_others = std::min(reserved_for_others, static_cast<size_t>(usable) - 1);
+
+    return static_cast<double>(in_flight + reserved_for_others) < usable;
+}
+
+void RequestScheduler::onRelease(RequestPriority priority)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --classes[static_cast<size_t>(priority)].stats.in_flight;
+    }
+    changed.notify_all();
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include "concurrency_limiter.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+
+/**
+ * @brief Классы приоритета запросов к серверам llama-server.
+ *
+ * Меньшее значение означает более высокий приоритет.
+ */
+enum class RequestPriority
+{
+    interactive = 0, ///< Эмбеддинг вопроса и генерация ответа.
+    background = 1   ///< Индексация документов.
+};
+
+/**
+ * @brief Состояние одного класса приоритета.
+ */
+struct PriorityClassStats
+{
+    size_t in_flight = 0; ///< Запросов в обработке.
+    size_t waiting = 0;   ///< Запросов, ожидающих допуска.
+    size_t admitted = 0;  ///< Всего допущено запросов.
+};
+
+/**
+ * @brief Планировщик допуска запросов с классами приоритета.
+ *
+ * Общую ёмкость задаёт адаптивный ConcurrencyLimiter. Планировщик решает, какой
+ * из ожидающих запросов получит освободившийся слот: сначала интерактивные,
+ * затем фоновые. Для каждого класса можно зарезервировать слоты, которые другие
+ * классы не занимают, и ограничить частоту запросов (token bucket).
+ */
+class RequestScheduler
+{
+public:
+    static constexpr size_t n_classes = 2;
+
+    /**
+     * @brief RAII-допуск одного запроса.
+     */
+    class Ticket
+    {
+        RequestScheduler *owner;
+        RequestPriority priority;
+        ConcurrencyLimiter::Permit permit;
+
+    public:
+        Ticket(RequestScheduler *owner, RequestPriority priority, ConcurrencyLimiter::Permit permit);
+        Ticket(Ticket &&other) noexcept;
+        Ticket(const Ticket &) = delete;
+        Ticket &operator=(const Ticket &) = delete;
+        Ticket &operator=(Ticket &&) = delete;
+        ~Ticket();
+
+        /**
+         * @brief Завершение запроса.
+         *
+         * @param latency_ms - задержка запроса в миллисекундах
+         * @param ok - запрос завершился успешно
+         */
+        void release(double latency_ms, bool ok);
+    };
+
+    /**
+     * @param limiter - ограничитель, задающий общую ёмкость сервера
+     */
+    explicit RequestScheduler(ConcurrencyLimiter &limiter);
+
+    /**
+     * @brief Ожидает допуска запроса заданного класса.
+     *
+     * @param priority - класс приоритета
+     * @return Ticket - допуск, освобождаемый по завершении запроса
+     */
+    Ticket admit(RequestPriority priority);
+
+    /**
+     * @brief Допуск без ожидания (например, для дублирующего запроса).
+     *
+     * Не обгоняет запросы того же или более приоритетного класса, уже ожидающие допуска.
+     *
+     * @param priority - класс приоритета
+     * @return Ticket или пусто, если слота сейчас нет
+     */
+    std::optional<Ticket> tryAdmit(RequestPriority priority);
+
+    /**
+     * @brief Настройка класса приоритета.
+     *
+     * @param priority - класс приоритета
+     * @param reserved - количество слотов, зарезервированных за классом
+     * @param rate_limit - максимальное количество запросов в секунду (0 - без ограничения)
+     */
+    void configure(RequestPriority priority, size_t reserved, double rate_limit);
+
+    /**
+     * @brief Текущее состояние класса приоритета.
+     */
+    PriorityClassStats stats(RequestPriority priority) const;
+
+private:
+    struct PriorityClass
+    {
+        size_t reserved = 0;
+        double rate_limit = 0;
+        double tokens = 0;
+        std::chrono::steady_clock::time_point refilled = std::chrono::steady_clock::now();
+        PriorityClassStats stats;
+    };
+
+    ConcurrencyLimiter &limiter;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    PriorityClass classes[n_classes];
+
+    /**
+     * @brief Может ли класс занять слот прямо сейчас.
+     *
+     * @param index - индекс класса
+     * @param retry_at - момент появления токена, если класс упёрся в ограничение частоты
+     */
+    bool canAdmit(size_t index, std::chrono::steady_clock::time_point &retry_at);
+
+    /**
+     * @brief Занять слот ограничителя и учесть допуск; вызывается под mutex после canAdmit.
+     */
+    std::optional<Ticket> take(size_t index);
+
+    void onRelease(RequestPriority priority);
+};
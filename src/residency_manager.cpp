@@ -0,0 +1,142 @@
+#include "residency_manager.hpp"
+#include <algorithm>
+#include <vector>
+
+ResidencyManager::ResidencyManager(size_t memory_budget) : budget(memory_budget)
+{
+}
+
+void ResidencyManager::use(const std::shared_ptr<VectorDatabase> &database)
+{
+    if (!database)
+    {
+        return;
+    }
+
+    database->makeResident();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = positions.find(database.get());
+        if (it != positions.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            // Адрес мог достаться новой БД после удаления прежней.
+            it->second->second = database;
+        }
+        else
+        {
+            lru.emplace_front(database.get(), database);
+            positions[database.get()] = lru.begin();
+        }
+    }
+    evict(database.get());
+}
+
+void ResidencyManager::forget(const VectorDatabase *database)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = positions.find(database);
+    if (it != positions.end())
+    {
+        lru.erase(it->second);
+        positions.erase(it);
+    }
+}
+
+void ResidencyManager::setBudget(size_t memory_budget)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = memory_budget;
+    }
+    evict(nullptr);
+}
+
+size_t ResidencyManager::getBudget() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return budget;
+}
+
+size_t ResidencyManager::residentBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return residentBytesLocked();
+}
+
+bool ResidencyManager::reserve(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (budget != 0 && residentBytesLocked() + reserved + bytes > budget)
+    {
+        return false;
+    }
+    reserved += bytes;
+    return true;
+}
+
+void ResidencyManager::release(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    reserved -= std::min(reserved, bytes);
+}
+
+size_t ResidencyManager::residentBytesLocked() const
+{
+    size_t total = 0;
+    for (const auto &entry : lru)
+    {
+        if (auto database = entry.second.lock())
+        {
+            total += database->memoryUsage();
+        }
+    }
+    return total;
+}
+
+void ResidencyManager::evict(const VectorDatabase *keep)
+{
+    std::vector<std::shared_ptr<VectorDatabase>> victims;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (budget == 0)
+        {
+            return;
+        }
+
+        std::vector<std::pair<std::shared_ptr<VectorDatabase>, size_t>> resident;
+        size_t total = 0;
+        for (auto it = lru.begin(); it != lru.end();)
+        {
+            auto database = it->second.lock();
+            if (!database)
+            {
+                positions.erase(it->first);
+                it = lru.erase(it);
+                continue;
+            }
+            size_t bytes = database->memoryUsage();
+            total += bytes;
+            resident.emplace_back(std::move(database), bytes);
+            ++it;
+        }
+
+        // Выгрузка начинается с давно не использованных БД.
+        for (auto it = resident.rbegin(); it != resident.rend() && total > budget; ++it)
+        {
+            auto options = it->first->getMappingOptions();
+            // В многоуровневом режиме lock не применяется, и такая БД выгружается как обычная.
+            if (it->first.get() != keep && it->second > 0 && (!options.lock || options.tiered))
+            {
+                total -= it->second;
+                victims.push_back(std::move(it->first));
+            }
+        }
+    }
+
+    // Выгрузка может сохранять файл, поэтому выполняется без блокировки.
+    for (const auto &database : victims)
+    {
+        database->unload();
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "vector_db.hpp"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @brief Состояние БД в памяти.
+ */
+struct DatabaseResidency
+{
+    int id = -1;             ///< Идентификатор БД.
+    std::string name;        ///< Имя БД.
+    bool resident = false;   ///< Загружена ли БД в память.
+    size_t memory_bytes = 0; ///< Оценка занимаемой памяти.
+    size_t vectors = 0;      ///< Количество записей.
+    float load_progress = 0; ///< Доля прочитанного файла (1 - БД загружена).
+};
+
+/**
+ * @brief Держит в памяти недавно использованные БД в пределах бюджета памяти.
+ *
+ * Каждое обращение к БД через use() загружает её (если она выгружена) и переносит в начало
+ * списка LRU. Если суммарный объём загруженных БД превышает бюджет, с конца списка
+ * выгружаются давно не использованные БД. БД, закреплённые в памяти (MappingOptions::lock),
+ * не выгружаются. Выгруженная БД остаётся в реестре и загрузится снова при следующем обращении.
+ */
+class ResidencyManager
+{
+public:
+    /**
+     * @param memory_budget - бюджет памяти в байтах (0 - без ограничения)
+     */
+    explicit ResidencyManager(size_t memory_budget = 0);
+
+    /**
+     * @brief Отметить использование БД: загрузить её и при необходимости выгрузить другие.
+     */
+    void use(const std::shared_ptr<VectorDatabase> &database);
+
+    /**
+     * @brief Исключить БД из учёта (например, при снятии с регистрации).
+     */
+    void forget(const VectorDatabase *database);
+
+    /**
+     * @brief Изменить бюджет памяти; лишние БД выгружаются сразу.
+     */
+    void setBudget(size_t memory_budget);
+
+    size_t getBudget() const;
+
+    /**
+     * @brief Суммарный объём загруженных БД в байтах.
+     */
+    size_t residentBytes() const;
+
+    /**
+     * @brief Зарезервировать память под БД до её загрузки.
+     *
+     * Параллельные загрузки видят резервы друг друга и вместе не превышают бюджет.
+     *
+     * @param bytes - оценка памяти БД
+     * @return true, если резерв помещается в бюджет (без бюджета - всегда); снимается через release()
+     */
+    bool reserve(size_t bytes);
+
+    /**
+     * @brief Снять резерв после загрузки БД (или её ошибки).
+     */
+    void release(size_t bytes);
+
+private:
+    using LruList = std::list<std::pair<const VectorDatabase *, std::weak_ptr<VectorDatabase>>>;
+
+    mutable std::mutex mutex;
+    size_t budget;
+    size_t reserved = 0; ///< Память, зарезервированная под загружаемые БД.
+    LruList lru; ///< В начале - недавно использованные БД.
+    std::unordered_map<const VectorDatabase *, LruList::iterator> positions;
+
+    /**
+     * @brief Суммарный объём загруженных БД; вызывается под mutex.
+     */
+    size_t residentBytesLocked() const;
+
+    /**
+     * @brief Выгрузить давно не использованные БД сверх бюджета, кроме keep.
+     */
+    void evict(const VectorDatabase *keep);
+};
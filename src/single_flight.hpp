@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @brief Объединение одновременных одинаковых вызовов.
+ *
+ * Первый вызов с данным ключом выполняет функцию, остальные вызовы с тем же
+ * ключом, пришедшие до её завершения, ждут и получают тот же результат
+ * (или то же исключение).
+ */
+template <typename Key, typename Value>
+class SingleFlight
+{
+    std::mutex mutex;
+    std::unordered_map<Key, std::shared_future<Value>> calls;
+    std::atomic<uint64_t> shared_calls{0};
+
+public:
+    /**
+     * @brief Выполнить функцию или присоединиться к уже выполняющемуся вызову.
+     *
+     * @param key - ключ вызова
+     * @param fn - функция, вычисляющая значение
+     * @return Value - результат
+     */
+    template <typename F>
+    Value run(const Key &key, F &&fn)
+    {
+        std::promise<Value> promise;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (auto it = calls.find(key); it != calls.end())
+            {
+                auto future = it->second;
+                lock.unlock();
+                ++shared_calls;
+                return future.get();
+            }
+            calls.emplace(key, promise.get_future().share());
+        }
+
+        try
+        {
+            Value value = fn();
+            finish(key);
+            promise.set_value(value);
+            return value;
+        }
+        catch (...)
+        {
+            finish(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    /**
+     * @brief Сколько вызовов получили результат чужого вызова.
+     */
+    uint64_t sharedCalls() const
+    {
+        return shared_calls.load();
+    }
+
+private:
+    void finish(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        calls.erase(key);
+    }
+};
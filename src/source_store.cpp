@@ -0,0 +1,291 @@
+#include "source_store.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// Признак ссылки на фрагмент в строке метаданных.
+#define SOURCE_REFERENCE_PREFIX "\x01src:"
+/// Размер порции при хешировании файла целиком.
+#define SOURCE_HASH_CHUNK (1 << 20)
+/// Начальное значение хеша FNV-1a.
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+
+namespace
+{
+/**
+ * @brief Продолжить хеш FNV-1a текстом.
+ */
+uint64_t fnv1a(uint64_t value, std::string_view text)
+{
+    for (unsigned char c : text)
+    {
+        value = (value ^ c) * 1099511628211ull;
+    }
+    return value;
+}
+
+/**
+ * @brief Прочитать length байт с позиции offset.
+ *
+ * @return true, если прочитано ровно length байт (файл мог быть усечён после проверки)
+ */
+bool readAt(int fd, char *buffer, size_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t read = ::pread(fd, buffer, length, static_cast<off_t>(offset));
+        if (read < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (read <= 0)
+        {
+            return false;
+        }
+        buffer += read;
+        length -= read;
+        offset += read;
+    }
+    return true;
+}
+} // namespace
+
+/**
+ * @brief Состояние файла документа на момент последней проверки хеша.
+ */
+struct SourceStore::FileState
+{
+    dev_t device = 0;
+    ino_t inode = 0;
+    uint64_t size = 0;
+    timespec modified{};
+
+    explicit FileState(const struct stat &st)
+        : device(st.st_dev), inode(st.st_ino), size(st.st_size), modified(st.st_mtim)
+    {
+    }
+
+    /**
+     * @brief Совпадает ли файл с проверенным.
+     */
+    bool matches(const struct stat &st) const
+    {
+        return st.st_dev == device && st.st_ino == inode && static_cast<uint64_t>(st.st_size) == size &&
+               st.st_mtim.tv_sec == modified.tv_sec && st.st_mtim.tv_nsec == modified.tv_nsec;
+    }
+};
+
+struct SourceStore::Document
+{
+    SourceDocument info;
+    std::unique_ptr<FileState> checked; ///< Последний проверенный файл (в том числе изменённый).
+};
+
+SourceStore::SourceStore(std::string index_path) : index_path(std::move(index_path))
+{
+    std::ifstream file(this->index_path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        // Строка индекса: идентификатор, хеш (hex), размер и путь через табуляцию.
+        // Повреждённая строка пропускается: ссылки на другие документы остаются рабочими.
+        std::stringstream fields(line);
+        auto document = std::make_unique<Document>();
+        std::string hash_text;
+        bool parsed = (fields >> document->info.id >> hash_text >> document->info.size) && fields.get() == '\t' &&
+                      std::getline(fields, document->info.path);
+        if (parsed)
+        {
+            auto hash_end = hash_text.data() + hash_text.size();
+            auto result = std::from_chars(hash_text.data(), hash_end, document->info.hash, 16);
+            parsed = result.ec == std::errc() && result.ptr == hash_end && !documents.count(document->info.id);
+        }
+        if (!parsed)
+        {
+            std::cerr << "Повреждена строка индекса источников " << this->index_path << ": " << line << std::endl;
+            continue;
+        }
+        // Новые документы получают идентификаторы больше всех прочитанных, даже если часть строк пропущена.
+        next_id = std::max(next_id, document->info.id + 1);
+        documents.emplace(document->info.id, std::move(document));
+    }
+}
+
+SourceStore::~SourceStore() = default;
+
+uint32_t SourceStore::addDocument(const std::string &path, std::string_view content)
+{
+    auto content_hash = hash(content);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &[id, document] : documents)
+    {
+        if (document->info.path == path && document->info.hash == content_hash &&
+            document->info.size == content.size())
+        {
+            return id;
+        }
+    }
+
+    auto document = std::make_unique<Document>();
+    document->info.id = next_id;
+    document->info.path = path;
+    document->info.size = content.size();
+    document->info.hash = content_hash;
+
+    std::ofstream file(index_path, std::ios::app);
+    char hash_text[17];
+    std::snprintf(hash_text, sizeof(hash_text), "%016llx", static_cast<unsigned long long>(content_hash));
+    file << document->info.id << '\t' << hash_text << '\t' << document->info.size << '\t' << path << '\n';
+    if (!file.flush())
+    {
+        throw std::runtime_error("Cannot write source index: " + index_path);
+    }
+
+    ++next_id;
+    uint32_t id = document->info.id;
+    documents.emplace(id, std::move(document));
+    return id;
+}
+
+bool SourceStore::resolve(const SourceReference &reference, std::string &text)
+{
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = documents.find(reference.document);
+        if (it == documents.end())
+        {
+            return false;
+        }
+        uint64_t size = it->second->info.size;
+        if (reference.offset > size || reference.length > size - reference.offset)
+        {
+            return false;
+        }
+        fd = openDocument(*it->second);
+    }
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // Файл мог измениться после проверки: короткое чтение или чужой текст отсекаются
+    // длиной и хешем фрагмента.
+    text.resize(reference.length);
+    bool read = readAt(fd, text.data(), text.size(), reference.offset);
+    ::close(fd);
+    if (!read || hash(text) != reference.hash)
+    {
+        text.clear();
+        return false;
+    }
+    return true;
+}
+
+std::vector<SourceDocument> SourceStore::check()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<SourceDocument> result;
+    for (auto &[id, document] : documents)
+    {
+        int fd = openDocument(*document);
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        result.push_back(document->info);
+    }
+    return result;
+}
+
+int SourceStore::openDocument(Document &document)
+{
+    int fd = ::open(document.info.path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        if (!document.info.stale)
+        {
+            std::cerr << "Источник недоступен: " << document.info.path << std::endl;
+        }
+        document.checked.reset();
+        document.info.stale = true;
+        return -1;
+    }
+
+    if (!document.checked || !document.checked->matches(st))
+    {
+        bool stale = static_cast<uint64_t>(st.st_size) != document.info.size;
+        uint64_t value = FNV_OFFSET_BASIS;
+        std::string chunk;
+        for (uint64_t offset = 0; !stale && offset < document.info.size; offset += chunk.size())
+        {
+            chunk.resize(std::min<uint64_t>(SOURCE_HASH_CHUNK, document.info.size - offset));
+            stale = !readAt(fd, chunk.data(), chunk.size(), offset);
+            value = fnv1a(value, chunk);
+        }
+        stale = stale || value != document.info.hash;
+        if (stale && !document.info.stale)
+        {
+            std::cerr << "Источник изменён после индексации: " << document.info.path << std::endl;
+        }
+        document.checked = std::make_unique<FileState>(st);
+        document.info.stale = stale;
+    }
+    if (document.info.stale)
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+std::string SourceStore::encode(const SourceReference &reference)
+{
+    char hash_text[17];
+    std::snprintf(hash_text, sizeof(hash_text), "%016llx", static_cast<unsigned long long>(reference.hash));
+    return SOURCE_REFERENCE_PREFIX + std::to_string(reference.document) + ":" + std::to_string(reference.offset) +
+           ":" + std::to_string(reference.length) + ":" + hash_text;
+}
+
+bool SourceStore::decode(std::string_view metadata, SourceReference &reference)
+{
+    std::string_view prefix = SOURCE_REFERENCE_PREFIX;
+    if (metadata.substr(0, prefix.size()) != prefix)
+    {
+        return false;
+    }
+    const char *pos = metadata.data() + prefix.size();
+    const char *end = metadata.data() + metadata.size();
+
+    auto field = [&](auto &value, int base, bool last)
+    {
+        auto parsed = std::from_chars(pos, end, value, base);
+        if (parsed.ec != std::errc() || (last ? parsed.ptr != end : parsed.ptr == end || *parsed.ptr != ':'))
+        {
+            return false;
+        }
+        pos = parsed.ptr + (last ? 0 : 1);
+        return true;
+    };
+    return field(reference.document, 10, false) && field(reference.offset, 10, false) &&
+           field(reference.length, 10, false) && field(reference.hash, 16, true);
+}
+
+uint64_t SourceStore::hash(std::string_view text)
+{
+    return fnv1a(FNV_OFFSET_BASIS, text);
+}
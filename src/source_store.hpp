@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Ссылка на фрагмент исходного файла, хранимая в метаданных вместо текста.
+ */
+struct SourceReference
+{
+    uint32_t document = 0; ///< Идентификатор документа в SourceStore.
+    uint64_t offset = 0;   ///< Смещение фрагмента в файле (байты).
+    uint64_t length = 0;   ///< Длина фрагмента (байты).
+    uint64_t hash = 0;     ///< Хеш текста фрагмента.
+};
+
+/**
+ * @brief Зарегистрированный исходный документ.
+ */
+struct SourceDocument
+{
+    uint32_t id = 0;
+    std::string path;
+    uint64_t size = 0;   ///< Размер файла при индексации.
+    uint64_t hash = 0;   ///< Хеш содержимого файла при индексации.
+    bool stale = false;  ///< Файл изменён или удалён после индексации.
+};
+
+/**
+ * @brief Хранилище исходных документов, на фрагменты которых ссылаются БД.
+ *
+ * Список документов (идентификатор, хеш, размер, путь) хранится в текстовом индексе
+ * и дополняется при регистрации. Фрагменты читаются из файлов по требованию.
+ * Целостность проверяется дважды: хеш всего файла - после каждого изменения файла,
+ * хеш фрагмента - при каждом чтении, поэтому изменённый источник не попадёт в промпт чужим текстом.
+ */
+class SourceStore
+{
+    struct FileState;
+    struct Document;
+
+    std::string index_path;
+    std::map<uint32_t, std::unique_ptr<Document>> documents;
+    uint32_t next_id = 0; ///< Идентификатор следующего документа (больше всех прочитанных).
+    mutable std::mutex mutex;
+
+public:
+    /**
+     * @param index_path - путь к индексу документов (читается, если существует)
+     */
+    explicit SourceStore(std::string index_path);
+    ~SourceStore();
+
+    /**
+     * @brief Зарегистрировать документ.
+     *
+     * Документ с тем же путём и содержимым регистрируется один раз.
+     *
+     * @param path - путь к файлу
+     * @param content - содержимое файла, по которому строятся ссылки
+     * @return uint32_t - идентификатор документа
+     * @throws std::runtime_error, если индекс не удалось записать
+     */
+    uint32_t addDocument(const std::string &path, std::string_view content);
+
+    /**
+     * @brief Прочитать текст фрагмента.
+     *
+     * @param reference - ссылка на фрагмент
+     * @param text - текст фрагмента
+     * @return true, если документ доступен и хеш фрагмента совпал
+     */
+    bool resolve(const SourceReference &reference, std::string &text);
+
+    /**
+     * @brief Проверить все документы и вернуть их состояние.
+     *
+     * Изменённые файлы хешируются заново.
+     *
+     * @return std::vector<SourceDocument>
+     */
+    std::vector<SourceDocument> check();
+
+    /**
+     * @brief Запись ссылки в строку метаданных.
+     *
+     * Строка начинается с управляющего символа \x01 и содержит только ASCII, поэтому
+     * остаётся корректным UTF-8 и не совпадает с текстом документа.
+     */
+    static std::string encode(const SourceReference &reference);
+
+    /**
+     * @brief Разбор строки метаданных.
+     *
+     * @return true, если строка - ссылка на фрагмент
+     */
+    static bool decode(std::string_view metadata, SourceReference &reference);
+
+    /**
+     * @brief Хеш текста (FNV-1a, 64 бита).
+     */
+    static uint64_t hash(std::string_view text);
+
+private:
+    /**
+     * @brief Открыть файл документа, проверив его хеш, если файл изменился с последней проверки.
+     *
+     * Вызывается под mutex.
+     *
+     * @return int - дескриптор файла; -1, если файл недоступен или изменён после индексации
+     */
+    int openDocument(Document &document);
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Пул потоков с очередью задач.
+ *
+ * Деструктор дожидается выполнения всех поставленных задач.
+ */
+class ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping = false;
+
+public:
+    /**
+     * @param n_threads - количество потоков (не меньше одного)
+     */
+    explicit ThreadPool(size_t n_threads)
+    {
+        if (n_threads == 0)
+        {
+            n_threads = 1;
+        }
+        for (size_t i = 0; i < n_threads; ++i)
+        {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    /**
+     * @brief Поставить задачу в очередь.
+     *
+     * @param fn - задача
+     * @return std::future с результатом задачи или её исключением
+     */
+    template <typename F>
+    auto submit(F &&fn) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+    {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(fn));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace([task]() { (*task)(); });
+        }
+        available.notify_one();
+        return future;
+    }
+
+    /**
+     * @brief Количество потоков пула.
+     */
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+private:
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
@@ -1,207 +1,1994 @@
 #include "vector_db.hpp"
+#include "embedding_codec.hpp"
+#include "thread_pool.hpp"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <random>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
 
+// Минимальный объём данных (float) на поток при параллельной нормализации.
+#define PARALLEL_MIN_FLOATS (1 << 16)
+// Доля удалённых строк, после которой по умолчанию запускается фоновое уплотнение.
+#define COMPACTION_THRESHOLD 0.25f
+// Меньшее количество удалённых строк не уплотняется автоматически.
+#define COMPACTION_MIN_DEAD_ROWS 64
+// Меньший объём заменённых текстов метаданных (байт) не уплотняется автоматически.
+#define COMPACTION_MIN_DEAD_BYTES (1 << 20)
+// Начальная ёмкость последнего сегмента (строк); дальше она удваивается до VectorSnapshot::segment_rows.
+#define SEGMENT_MIN_ROWS 64
+/// Минимальный объём данных файла на поток при параллельной загрузке.
+#define PARALLEL_MIN_LOAD_BYTES (16 << 20)
+/// Объём текстов метаданных в одном сжатом блоке (блок не пересекает границу сегмента).
+#define METADATA_BLOCK_BYTES (32 << 10)
+/// Наибольшая степень сжатия блока метаданных: байт длины совпадения даёт не больше 255 байт текста.
+#define LZ_MAX_RATIO 255
+/// Во сколько раз кандидатов приближённого этапа больше k (многоуровневый режим).
+#define TIER_OVERSAMPLE 4
+/// Кэш горячих строк - не больше 1/HOT_ROWS_DIVISOR строк БД: полный вектор вчетверо больше
+/// int8-строки, поэтому кэш занимает не больше четверти int8-копии.
+#define HOT_ROWS_DIVISOR 16
+/// Запас к порогу сходства на приближённом этапе: ошибка int8-сходства нормализованных векторов меньше.
+#define TIER_SCORE_MARGIN 0.05f
 
 namespace fs = std::filesystem;
 
+/**
+ * @brief Отображение начала файла БД (заголовок, ID и эмбеддинги) только для чтения.
+ *
+ * Сегменты ссылаются на отображение через shared_ptr: оно снимается, когда его отпускает
+ * последний снимок или прогрев.
+ */
+struct MappedFile
+{
+    void *address = nullptr;
+    size_t length = 0;
+    std::atomic<bool> locked{false};
+
+    ~MappedFile()
+    {
+        ::munmap(address, length);
+    }
+};
+
+namespace
+{
+/**
+ * @brief Заголовок файла БД версии 3.
+ *
+ * За заголовком следуют секции: ID (count x uint64), эмбеддинги (count x dimension x float,
+ * смещение выровнено на 64 байта), смещения метаданных ((count + 1) x uint64) и сами метаданные.
+ * В версии 3 метаданные сжаты блоками: за смещениями идут количество блоков (uint64),
+ * таблица блоков ((blocks + 1) x {первая строка, смещение сжатого блока}, uint64) и блоки.
+ * Файлы версии 2 (метаданные без сжатия) и версии 1 (без сигнатуры: size_t dimension,
+ * uint32 count, записи подряд) также читаются, версия 1 - с перенумерацией ID.
+ *
+ * С флагом flag_packed_embeddings секция эмбеддингов сжата по сегментам: по смещению
+ * embeddings_offset лежит таблица (segments + 1) x uint64 смещений блоков от конца таблицы,
+ * за ней блоки embedding_codec, по одному на сегмент из VectorSnapshot::segment_rows строк.
+ */
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t dimension;
+    uint64_t count;
+    uint64_t next_id;
+    uint64_t ids_offset;
+    uint64_t embeddings_offset;
+    uint64_t metadata_offset;
+};
+
+const char file_magic[8] = {'R', 'A', 'G', 'V', 'D', 'B', '\0', '\0'};
+const uint32_t file_version = 3;
+/// Последняя версия с метаданными без сжатия.
+const uint32_t file_version_plain = 2;
+/// Эмбеддинги сжаты без потерь по сегментам.
+const uint32_t flag_packed_embeddings = 1;
+
+uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @brief Размер файла (0, если файл недоступен).
+ */
+uint64_t fileSize(const std::string &path)
+{
+    std::error_code error;
+    uint64_t size = fs::file_size(path, error);
+    return error ? 0 : size;
+}
+
+/**
+ * @brief Секции ID, эмбеддингов и смещений метаданных идут по порядку и помещаются в файл.
+ *
+ * Проверка идёт до выделения памяти под count строк: повреждённый заголовок не должен
+ * приводить к огромным выделениям.
+ */
+bool validSections(const FileHeader &header, uint64_t file_size, bool packed_embeddings)
+{
+    uint64_t vector_bytes = header.dimension * sizeof(float);
+    if (header.ids_offset < sizeof(FileHeader) || header.ids_offset > header.embeddings_offset ||
+        header.embeddings_offset > header.metadata_offset || header.metadata_offset > file_size)
+    {
+        return false;
+    }
+    if (header.count > (header.embeddings_offset - header.ids_offset) / sizeof(uint64_t) ||
+        header.count >= (file_size - header.metadata_offset) / sizeof(uint64_t))
+    {
+        return false;
+    }
+    // Сжатые эмбеддинги проверяются по таблице блоков.
+    return packed_embeddings || vector_bytes == 0 ||
+           header.count <= (header.metadata_offset - header.embeddings_offset) / vector_bytes;
+}
+
+/**
+ * @brief Скалярное произведение с восемью независимыми аккумуляторами.
+ *
+ * Независимые суммы компилятор раскладывает в SIMD-регистр без -ffast-math.
+ */
+float dotProduct(const float *a, const float *b, size_t n)
+{
+    float acc[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        for (size_t j = 0; j < 8; ++j)
+        {
+            acc[j] += a[i + j] * b[i + j];
+        }
+    }
+    float sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    for (; i < n; ++i)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Сегмент с метаданными и битовой картой, но без ID и эмбеддингов.
+ */
+std::shared_ptr<VectorSegment> emptySegment(size_t capacity)
+{
+    auto segment = std::make_shared<VectorSegment>();
+    size_t words = (capacity + 63) / 64;
+    segment->capacity = capacity;
+    segment->metadata.reset(new std::string_view[capacity]);
+    segment->arena = std::make_shared<MetadataArena>();
+    segment->tombstones.reset(new std::atomic<uint64_t>[words]);
+    for (size_t i = 0; i < words; ++i)
+    {
+        segment->tombstones[i].store(0, std::memory_order_relaxed);
+    }
+    return segment;
+}
+
+/**
+ * @brief Сегмент с памятью под ID и эмбеддинги.
+ *
+ * @param index Номер сегмента в снимке: в режиме NUMA определяет узел.
+ */
+std::shared_ptr<VectorSegment> makeSegment(size_t capacity,
+                                           size_t dimension,
+                                           const MemoryOptions &options,
+                                           size_t index)
+{
+    auto segment = emptySegment(capacity);
+    segment->embeddings = placement::allocateFloats(capacity * dimension, options, index);
+    segment->ids.reset(new uint64_t[capacity]);
+    return segment;
+}
+
+/**
+ * @brief Сброс файла или каталога на диск (fsync).
+ *
+ * @return true, если данные записаны на диск.
+ */
+bool syncPath(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+/**
+ * @brief Отображение первых length байт файла только для чтения.
+ *
+ * @return Отображение или nullptr, если mmap недоступен.
+ */
+std::shared_ptr<MappedFile> mapFile(const std::string &path, size_t length, const MappingOptions &options)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (options.populate)
+    {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    void *address = ::mmap(nullptr, length, PROT_READ, flags, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+    {
+        std::cerr << "Ошибка отображения файла " << path << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    auto mapping = std::make_shared<MappedFile>();
+    mapping->address = address;
+    mapping->length = length;
+#ifdef MADV_HUGEPAGE
+    // Огромные страницы для файлового отображения - только подсказка ядру, ошибка не критична.
+    if (options.huge_pages)
+    {
+        ::madvise(address, length, MADV_HUGEPAGE);
+    }
+#endif
+    if (options.tiered)
+    {
+        // Отображение читается строками кандидатов: упреждающее чтение соседних страниц бесполезно.
+        ::madvise(address, length, MADV_RANDOM);
+    }
+    // В многоуровневом режиме отображение - холодный уровень: mlock закрепил бы в памяти
+    // все полные векторы, ради вытеснения которых режим и включают.
+    if (options.lock && !options.tiered)
+    {
+        if (::mlock(address, length) == 0)
+        {
+            mapping->locked = true;
+        }
+        else
+        {
+            std::cerr << "Ошибка mlock: " << std::strerror(errno) << std::endl;
+        }
+    }
+    return mapping;
+}
+
+/**
+ * @brief Пул потоков сканирования узла NUMA.
+ *
+ * У каждого узла свой пул по числу его процессоров: потоки привязываются к узлу при первой
+ * задаче и больше не выполняют чужую работу. Пулы создаются один раз и не уничтожаются,
+ * как и пул асинхронных методов модуля.
+ */
+ThreadPool &nodePool(size_t node)
+{
+    static const auto pools = []()
+    {
+        std::vector<ThreadPool *> result;
+        for (size_t i = 0; i < placement::nodeCount(); ++i)
+        {
+            result.push_back(new ThreadPool(std::max<size_t>(1, placement::nodeCpus(i).size())));
+        }
+        return result;
+    }();
+    return *pools[node % pools.size()];
+}
+
+/**
+ * @brief Чтение отображения: madvise(WILLNEED) и обход страниц в нескольких потоках.
+ */
+void touchPages(const MappedFile &mapping)
+{
+    ::madvise(mapping.address, mapping.length, MADV_WILLNEED);
+
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t pages = (mapping.length + page - 1) / page;
+    size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+    n_threads = std::max<size_t>(1, std::min<size_t>(n_threads, mapping.length / PARALLEL_MIN_LOAD_BYTES));
+    size_t per_thread = (pages + n_threads - 1) / n_threads;
+
+    auto touch = [&](size_t first, size_t last)
+    {
+        const volatile char *bytes = static_cast<const char *>(mapping.address);
+        char sum = 0;
+        for (size_t i = first; i < last; ++i)
+        {
+            sum ^= bytes[i * page];
+        }
+        (void)sum;
+    };
+    std::vector<std::thread> workers;
+    for (size_t first = per_thread; first < pages; first += per_thread)
+    {
+        workers.emplace_back(touch, first, std::min(pages, first + per_thread));
+    }
+    touch(0, std::min(pages, per_thread));
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ * @brief Обход строк [first_row, first_row + count) снимка непрерывными отрезками внутри сегментов.
+ *
+ * @param fn - вызывается как fn(сегмент, смещение в сегменте, длина отрезка)
+ */
+template <typename F>
+void forEachRun(const VectorSnapshot &snapshot, size_t first_row, size_t count, F fn)
+{
+    for (size_t row = first_row; row < first_row + count;)
+    {
+        const auto &segment = snapshot.segment(row);
+        size_t offset = row % VectorSnapshot::segment_rows;
+        size_t run = std::min(first_row + count - row, segment.capacity - offset);
+        fn(segment, offset, run);
+        row += run;
+    }
+}
+} // namespace
+
 VectorDatabase::VectorDatabase(const std::string &db_filename, size_t dim)
-    : filename(db_filename), dimension(dim), modified(false)
+    : filename(db_filename), dimension(dim), current(std::make_shared<const VectorSnapshot>()), modified(false),
+      compaction_threshold(COMPACTION_THRESHOLD), memory_options(std::make_shared<const MemoryOptions>())
+{
+}
+
+VectorDatabase::~VectorDatabase()
+{
+    if (compaction.valid())
+    {
+        compaction.wait();
+    }
+    if (warmup.valid())
+    {
+        warmup.wait();
+    }
+    if (modified)
+    {
+        save();
+    }
+}
+
+bool VectorDatabase::initialize()
+{
+    fs::path new_folder = "db";
+
+    try
+    {
+        fs::create_directory(new_folder);
+    }
+    catch (const fs::filesystem_error &e)
+    {
+        std::cerr << "Ошибка: " << e.what() << '\n';
+    }
+
+    if (load())
+    {
+        std::cout << "База данных загружена: " << size() << " векторов" << std::endl;
+        return true;
+    }
+    std::error_code error;
+    if (fs::exists(filePath(), error))
+    {
+        // Повреждённый или недоступный файл не заменяется пустой БД.
+        std::cerr << "Ошибка: файл базы данных не прочитан: " << filePath() << std::endl;
+        return false;
+    }
+
+    if (!writeFile(*snapshot(), filePath()))
+    {
+        std::cerr << "Ошибка создания файла базы данных" << std::endl;
+        return false;
+    }
+
+    std::cout << "Создана новая база данных, размерность: " << dimension << std::endl;
+    return true;
+}
+
+bool VectorDatabase::attach()
+{
+    size_t file_dimension = 0;
+    size_t count = 0;
+    if (!readHeader(filePath(), file_dimension, count))
+    {
+        return false;
+    }
+    if (file_dimension != dimension)
+    {
+        std::cerr << "Ошибка: размерность в файле не совпадает с ожидаемой" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    file_rows = count;
+    ++rewrite_epoch;
+    publish(nullptr);
+    return true;
+}
+
+void VectorDatabase::makeResident() const
+{
+    snapshot();
+}
+
+bool VectorDatabase::unload()
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (!std::atomic_load(&current))
+    {
+        return true;
+    }
+    if (modified && !saveLocked())
+    {
+        return false;
+    }
+
+    file_rows = size();
+    load_done = 0;
+    load_total = 0;
+    ++rewrite_epoch;
+    publish(nullptr);
+    std::cout << "База данных выгружена из памяти: " << filename << std::endl;
+    return true;
+}
+
+bool VectorDatabase::isResident() const
+{
+    return std::atomic_load(&current) != nullptr;
+}
+
+float VectorDatabase::loadProgress() const
+{
+    if (isResident())
+    {
+        return 1.0f;
+    }
+    uint64_t total = load_total.load();
+    return total > 0 ? static_cast<float>(load_done.load()) / total : 0.0f;
+}
+
+size_t VectorDatabase::memoryUsage() const
+{
+    auto snap = std::atomic_load(&current);
+    if (!snap)
+    {
+        return 0;
+    }
+
+    size_t bytes = snap->index.size() * VectorSnapshot::index_chunk * sizeof(size_t);
+    for (const auto &segment : snap->segments)
+    {
+        // Хранилище учитывается целиком: заменённые тексты занимают память до уплотнения.
+        bytes += segment->arena->capacity() + (segment->packed ? segment->packed->memoryUsage() : 0);
+        // Полные векторы сегмента с int8-копией остаются в файле.
+        size_t row_bytes = segment->quantized ? dimension * sizeof(int8_t) + sizeof(float) : dimension * sizeof(float);
+        bytes += segment->capacity * (row_bytes + sizeof(uint64_t) + sizeof(std::string_view)) +
+                 (segment->capacity + 63) / 64 * sizeof(uint64_t);
+    }
+    if (snap->hot_rows)
+    {
+        bytes += snap->hot_rows->memoryUsage();
+    }
+    return bytes;
+}
+
+size_t VectorDatabase::estimatedMemoryUsage() const
+{
+    if (size_t bytes = memoryUsage())
+    {
+        return bytes;
+    }
+    size_t row_bytes = getMappingOptions().tiered ? dimension * sizeof(int8_t) + sizeof(float) : dimension * sizeof(float);
+    size_t rows = file_rows.load();
+    size_t index_bytes = (rows / VectorSnapshot::index_chunk + 1) * VectorSnapshot::index_chunk * sizeof(size_t);
+    return rows * (row_bytes + sizeof(uint64_t) + sizeof(std::string_view)) + index_bytes;
+}
+
+bool VectorDatabase::readHeader(const std::string &path, size_t &dimension, size_t &count)
+{
+    std::ifstream file(path, std::ios::binary);
+    FileHeader header{};
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+    {
+        // Файл старого формата короче заголовка, если в нём нет записей.
+        file.clear();
+        file.seekg(0);
+    }
+    if (std::equal(std::begin(file_magic), std::end(file_magic), header.magic))
+    {
+        dimension = header.dimension;
+        count = header.count;
+        return (header.version == file_version || header.version == file_version_plain) &&
+               (header.flags & ~flag_packed_embeddings) == 0;
+    }
+
+    size_t legacy_dimension = 0;
+    uint32_t legacy_count = 0;
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(&legacy_dimension), sizeof(size_t));
+    file.read(reinterpret_cast<char *>(&legacy_count), sizeof(uint32_t));
+    if (!file)
+    {
+        return false;
+    }
+    dimension = legacy_dimension;
+    count = legacy_count;
+    return true;
+}
+
+uint64_t VectorDatabase::addEmbedding(const std::vector<float> &embedding, const std::string &metadata)
+{
+    if (embedding.size() != dimension)
+    {
+        std::cerr << "Ошибка: размерность эмбеддинга (" << embedding.size() << ") не совпадает с размерностью БД ("
+                  << dimension << ")" << std::endl;
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    auto new_ids = appendRows(1,
+                              [&](size_t, float *row, std::string_view &text)
+                              {
+                                  std::copy(embedding.begin(), embedding.end(), row);
+                                  text = metadata;
+                              });
+
+    std::cout << "Добавлен вектор ID: " << new_ids[0] << std::endl;
+    return new_ids[0];
+}
+
+std::vector<uint64_t> VectorDatabase::addEmbeddings(const float *data,
+                                                    size_t count,
+                                                    const std::vector<std::string> &metadata)
+{
+    if (!metadata.empty() && metadata.size() != count)
+    {
+        std::cerr << "Ошибка: количество метаданных (" << metadata.size() << ") не совпадает с количеством векторов ("
+                  << count << ")" << std::endl;
+        return {};
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    auto new_ids = appendRows(count,
+                              [&](size_t i, float *row, std::string_view &text)
+                              {
+                                  std::copy(data + i * dimension, data + (i + 1) * dimension, row);
+                                  if (!metadata.empty())
+                                  {
+                                      text = metadata[i];
+                                  }
+                              });
+
+    std::cout << "Добавлено векторов: " << count << std::endl;
+    return new_ids;
+}
+
+std::vector<uint64_t> VectorDatabase::addEmbeddings(std::vector<VectorRecord> &&batch)
+{
+    for (const auto &record : batch)
+    {
+        if (record.embedding.size() != dimension)
+        {
+            std::cerr << "Ошибка: размерность эмбеддинга (" << record.embedding.size()
+                      << ") не совпадает с размерностью БД (" << dimension << ")" << std::endl;
+            return {};
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    auto new_ids = appendRows(batch.size(),
+                              [&](size_t i, float *row, std::string_view &text)
+                              {
+                                  std::copy(batch[i].embedding.begin(), batch[i].embedding.end(), row);
+                                  text = batch[i].metadata;
+                              });
+    batch.clear();
+
+    std::cout << "Добавлено векторов: " << new_ids.size() << std::endl;
+    return new_ids;
+}
+
+std::vector<uint64_t> VectorDatabase::appendRows(size_t count,
+                                                 const std::function<void(size_t, float *, std::string_view &)> &fill)
+{
+    auto next = std::make_shared<VectorSnapshot>(*residentSnapshot());
+    reserveRows(*next, count);
+
+    // Строки за границей опубликованного снимка читателям не видны, их можно заполнять без синхронизации.
+    size_t first_row = next->rows;
+    std::vector<uint64_t> new_ids(count);
+    size_t i = 0;
+    forEachRun(*next,
+               first_row,
+               count,
+               [&](const VectorSegment &segment, size_t offset, size_t run)
+               {
+                   for (size_t j = 0; j < run; ++j, ++i)
+                   {
+                       std::string_view text;
+                       fill(i, segment.embeddings.get() + (offset + j) * dimension, text);
+                       segment.metadata[offset + j] = segment.arena->append(text);
+                       next->metadata_bytes += text.size();
+                       new_ids[i] = next->next_id + i;
+                       segment.ids[offset + j] = new_ids[i];
+                   }
+                   normalizeRows(segment.embeddings.get() + offset * dimension, run);
+               });
+
+    next->rows += count;
+    next->next_id += count;
+    indexRows(*next, first_row, count);
+    modified = modified || count > 0;
+    publish(std::move(next));
+    return new_ids;
+}
+
+void VectorDatabase::reserveRows(VectorSnapshot &snapshot, size_t count) const
+{
+    const size_t segment_rows = VectorSnapshot::segment_rows;
+    auto options = std::atomic_load(&memory_options);
+    size_t needed = snapshot.rows + count;
+    while (true)
+    {
+        size_t full = snapshot.segments.empty() ? 0 : (snapshot.segments.size() - 1) * segment_rows;
+        size_t capacity = snapshot.segments.empty() ? 0 : full + snapshot.segments.back()->capacity;
+        if (capacity >= needed)
+        {
+            return;
+        }
+
+        if (!snapshot.segments.empty() && snapshot.segments.back()->capacity < segment_rows)
+        {
+            const auto &tail = *snapshot.segments.back();
+            size_t used = snapshot.rows - full;
+            auto grown = makeSegment(std::min(segment_rows, std::max(tail.capacity * 2, needed - full)),
+                                     dimension,
+                                     *options,
+                                     snapshot.segments.size() - 1);
+            std::copy(tail.embeddings.get(), tail.embeddings.get() + used * dimension, grown->embeddings.get());
+            std::copy(tail.ids.get(), tail.ids.get() + used, grown->ids.get());
+            std::copy(tail.metadata.get(), tail.metadata.get() + used, grown->metadata.get());
+            // Тексты не копируются: увеличенный сегмент продолжает хранилище прежнего.
+            grown->arena = tail.arena;
+            grown->packed = tail.packed;
+            for (size_t w = 0; w < (used + 63) / 64; ++w)
+            {
+                grown->tombstones[w].store(tail.tombstones[w].load(std::memory_order_relaxed),
+                                           std::memory_order_relaxed);
+            }
+            snapshot.segments.back() = std::move(grown);
+        }
+        else
+        {
+            size_t remaining = needed - snapshot.segments.size() * segment_rows;
+            snapshot.segments.push_back(
+                makeSegment(std::min(segment_rows, std::max<size_t>(SEGMENT_MIN_ROWS, remaining)),
+                            dimension,
+                            *options,
+                            snapshot.segments.size()));
+        }
+    }
+}
+
+void VectorDatabase::indexRows(VectorSnapshot &snapshot, size_t first_row, size_t count)
+{
+    // Блоки индекса общие для снимков, но каждая ячейка пишется до публикации ID и больше не меняется.
+    for (size_t row = first_row; row < first_row + count; ++row)
+    {
+        uint64_t id = snapshot.segment(row).ids[row % VectorSnapshot::segment_rows];
+        size_t chunk = id / VectorSnapshot::index_chunk;
+        while (snapshot.index.size() <= chunk)
+        {
+            std::shared_ptr<size_t[]> block(new size_t[VectorSnapshot::index_chunk]);
+            std::fill(block.get(), block.get() + VectorSnapshot::index_chunk, invalid_row);
+            snapshot.index.push_back(std::move(block));
+        }
+        snapshot.index[chunk][id % VectorSnapshot::index_chunk] = row;
+    }
+}
+
+size_t VectorDatabase::findRow(const VectorSnapshot &snapshot, uint64_t id)
+{
+    if (id == 0 || id >= snapshot.next_id || id / VectorSnapshot::index_chunk >= snapshot.index.size())
+    {
+        return invalid_row;
+    }
+    size_t row = snapshot.index[id / VectorSnapshot::index_chunk][id % VectorSnapshot::index_chunk];
+    if (row >= snapshot.rows || snapshot.segment(row).isDead(row % VectorSnapshot::segment_rows))
+    {
+        return invalid_row;
+    }
+    return row;
+}
+
+std::shared_ptr<const VectorSnapshot> VectorDatabase::snapshot() const
+{
+    if (auto snap = std::atomic_load(&current))
+    {
+        return snap;
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    return residentSnapshot();
+}
+
+std::shared_ptr<const VectorSnapshot> VectorDatabase::residentSnapshot() const
+{
+    if (auto snap = std::atomic_load(&current))
+    {
+        return snap;
+    }
+
+    bool legacy = false;
+    std::shared_ptr<const VectorSnapshot> loaded = readFile(legacy, mapping_options);
+    if (!loaded)
+    {
+        // БД остаётся выгруженной: пустой снимок вместо данных файла перезаписал бы файл при сохранении.
+        std::cerr << "Ошибка загрузки базы данных: " << filename << std::endl;
+        throw std::runtime_error("Failed to load database: " + filename);
+    }
+    std::cout << "База данных загружена в память: " << filename << ", " << loaded->rows << " векторов" << std::endl;
+    startWarmUp(*loaded);
+    ++rewrite_epoch;
+    publish(loaded);
+    return loaded;
+}
+
+void VectorDatabase::publish(std::shared_ptr<const VectorSnapshot> next) const
+{
+    std::atomic_store(&current, std::move(next));
+}
+
+std::string VectorDatabase::filePath() const
+{
+    return fs::path(filename).has_parent_path() ? filename : "./db/" + filename;
+}
+
+void VectorDatabase::normalizeRows(float *rows, size_t count) const
+{
+    size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+    n_threads = std::min(n_threads, count * dimension / PARALLEL_MIN_FLOATS);
+    if (n_threads <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            normalizeVector(rows + i * dimension);
+        }
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    size_t per_thread = (count + n_threads - 1) / n_threads;
+    for (size_t begin = 0; begin < count; begin += per_thread)
+    {
+        size_t end = std::min(count, begin + per_thread);
+        workers.emplace_back(
+            [this, rows, begin, end]()
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    normalizeVector(rows + i * dimension);
+                }
+            });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+std::vector<std::pair<uint64_t, float>> VectorDatabase::findTopK(const std::vector<float> &query,
+                                                                 uint32_t k,
+                                                                 float similarity_threshold) const
+{
+    return findTopK(*snapshot(), query, k, similarity_threshold);
+}
+
+std::vector<std::pair<uint64_t, float>> VectorDatabase::findTopK(const VectorSnapshot &snapshot,
+                                                                 const std::vector<float> &query,
+                                                                 uint32_t k,
+                                                                 float similarity_threshold) const
+{
+    if (query.size() != dimension)
+    {
+        std::cerr << "Ошибка: размерность запроса не совпадает с размерностью БД" << std::endl;
+        return {};
+    }
+
+    std::vector<float> normalized_query = query;
+    normalizeVector(normalized_query.data());
+
+    return searchNormalized(snapshot, normalized_query.data(), k, similarity_threshold);
+}
+
+bool VectorDatabase::findTopKBatch(const float *queries,
+                                   size_t n_queries,
+                                   uint32_t k,
+                                   float similarity_threshold,
+                                   uint64_t *out_ids,
+                                   float *out_scores) const
+{
+    if (k == 0)
+    {
+        return false;
+    }
+
+    auto snap = snapshot();
+    std::vector<float> normalized_query(dimension);
+    for (size_t q = 0; q < n_queries; ++q)
+    {
+        std::copy(queries + q * dimension, queries + (q + 1) * dimension, normalized_query.begin());
+        normalizeVector(normalized_query.data());
+
+        auto found = searchNormalized(*snap, normalized_query.data(), k, similarity_threshold);
+        for (uint32_t i = 0; i < k; ++i)
+        {
+            out_ids[q * k + i] = i < found.size() ? found[i].first : 0;
+            out_scores[q * k + i] = i < found.size() ? found[i].second : std::nanf("");
+        }
+    }
+    return true;
+}
+
+std::vector<std::pair<uint64_t, float>> VectorDatabase::searchNormalized(const VectorSnapshot &snapshot,
+                                                                         const float *query,
+                                                                         uint32_t k,
+                                                                         float similarity_threshold) const
+{
+    std::vector<std::pair<uint64_t, float>> similarities;
+    auto by_similarity = [](const std::pair<uint64_t, float> &a, const std::pair<uint64_t, float> &b)
+    { return a.second > b.second; };
+
+    // Сегменты с int8-копией сначала сравниваются приближённо, лучшие кандидаты уточняются по полным векторам.
+    QuantizedQuery approximate;
+    bool tiered = std::any_of(snapshot.segments.begin(),
+                              snapshot.segments.end(),
+                              [](const std::shared_ptr<const VectorSegment> &segment) { return segment->quantized; });
+    size_t candidates = k;
+    if (tiered)
+    {
+        approximate.codes.resize(dimension);
+        approximate.scale = quantization::quantize(query, dimension, approximate.codes.data());
+        // В size_t: k * TIER_OVERSAMPLE переполнил бы uint32_t при большом k.
+        candidates = std::min<size_t>(size_t(k) * TIER_OVERSAMPLE, snapshot.rows);
+    }
+    const QuantizedQuery *approximate_query = tiered ? &approximate : nullptr;
+
+    if (std::atomic_load(&memory_options)->numa && placement::nodeCount() > 1 && snapshot.segments.size() > 1)
+    {
+        similarities = scanNuma(snapshot, query, approximate_query, candidates, similarity_threshold);
+    }
+    else
+    {
+        for (size_t index = 0; index < snapshot.segments.size(); ++index)
+        {
+            scanSegment(snapshot, index, query, approximate_query, similarity_threshold, similarities);
+        }
+    }
+
+    if (tiered)
+    {
+        candidates = std::min(candidates, similarities.size());
+        std::partial_sort(
+            similarities.begin(), similarities.begin() + candidates, similarities.end(), by_similarity);
+        similarities.resize(candidates);
+        rerank(snapshot, query, similarities);
+        similarities.erase(std::remove_if(similarities.begin(),
+                                          similarities.end(),
+                                          [similarity_threshold](const std::pair<uint64_t, float> &found)
+                                          { return found.second < similarity_threshold; }),
+                           similarities.end());
+    }
+
+    if (k > similarities.size())
+    {
+        k = static_cast<uint32_t>(similarities.size());
+    }
+
+    std::partial_sort(similarities.begin(), similarities.begin() + k, similarities.end(), by_similarity);
+
+    similarities.resize(k);
+    return similarities;
+}
+
+void VectorDatabase::scanSegment(const VectorSnapshot &snapshot,
+                                 size_t index,
+                                 const float *query,
+                                 const QuantizedQuery *approximate,
+                                 float similarity_threshold,
+                                 std::vector<std::pair<uint64_t, float>> &out) const
+{
+    const auto &segment = *snapshot.segments[index];
+    size_t first_row = index * VectorSnapshot::segment_rows;
+    size_t used = first_row < snapshot.rows ? std::min(segment.capacity, snapshot.rows - first_row) : 0;
+    const QuantizedRows *quantized = approximate ? segment.quantized.get() : nullptr;
+    if (quantized)
+    {
+        similarity_threshold -= TIER_SCORE_MARGIN;
+    }
+    for (size_t j = 0; j < used; ++j)
+    {
+        // Полностью живые слова битовой карты проверяются одним сравнением.
+        if (segment.tombstones[j / 64].load(std::memory_order_relaxed) != 0 && segment.isDead(j))
+        {
+            continue;
+        }
+        float similarity =
+            quantized ? quantization::dot(approximate->codes.data(), quantized->codes.get() + j * dimension, dimension) *
+                            approximate->scale * quantized->scales[j]
+                      : cosineSimilarity(query, segment.embeddings.get() + j * dimension);
+
+        if (similarity >= similarity_threshold)
+        {
+            out.push_back(std::make_pair(segment.ids[j], similarity));
+        }
+    }
+}
+
+std::vector<std::pair<uint64_t, float>> VectorDatabase::scanNuma(const VectorSnapshot &snapshot,
+                                                                 const float *query,
+                                                                 const QuantizedQuery *approximate,
+                                                                 size_t k,
+                                                                 float similarity_threshold) const
+{
+    size_t nodes = placement::nodeCount();
+    std::vector<std::future<std::vector<std::pair<uint64_t, float>>>> parts;
+    for (size_t node = 0; node < nodes && node < snapshot.segments.size(); ++node)
+    {
+        // Сегменты узла node: node, node + nodes, ...; делятся между процессорами узла.
+        size_t node_segments = (snapshot.segments.size() - node + nodes - 1) / nodes;
+        size_t workers = std::max<size_t>(1, std::min(placement::nodeCpus(node).size(), node_segments));
+        for (size_t worker = 0; worker < workers; ++worker)
+        {
+            parts.push_back(nodePool(node).submit(
+                [&, node, worker, workers]()
+                {
+                    placement::pinToNode(node);
+                    std::vector<std::pair<uint64_t, float>> found;
+                    for (size_t index = node + worker * nodes; index < snapshot.segments.size();
+                         index += workers * nodes)
+                    {
+                        scanSegment(snapshot, index, query, approximate, similarity_threshold, found);
+                    }
+
+                    // Поток возвращает только свои лучшие k: слияние не копирует все совпадения.
+                    size_t keep = std::min(k, found.size());
+                    std::partial_sort(found.begin(),
+                                      found.begin() + keep,
+                                      found.end(),
+                                      [](const std::pair<uint64_t, float> &a, const std::pair<uint64_t, float> &b)
+                                      { return a.second > b.second; });
+                    found.resize(keep);
+                    return found;
+                }));
+        }
+    }
+
+    std::vector<std::pair<uint64_t, float>> similarities;
+    for (auto &part : parts)
+    {
+        auto found = part.get();
+        similarities.insert(similarities.end(), found.begin(), found.end());
+    }
+    return similarities;
+}
+
+void VectorDatabase::rerank(const VectorSnapshot &snapshot,
+                            const float *query,
+                            std::vector<std::pair<uint64_t, float>> &candidates) const
+{
+    static const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t row_bytes = dimension * sizeof(float);
+
+    // Первый проход: кэш горячих строк и пакетный запрос страниц остальных кандидатов.
+    std::vector<float> cached(candidates.size() * dimension);
+    std::vector<const float *> vectors(candidates.size(), nullptr);
+    std::vector<bool> missed(candidates.size(), false);
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        size_t row = findRow(snapshot, candidates[i].first);
+        if (row == invalid_row)
+        {
+            continue;
+        }
+        const auto &segment = snapshot.segment(row);
+        const float *vector = segment.embeddings.get() + (row % VectorSnapshot::segment_rows) * dimension;
+        if (!segment.quantized)
+        {
+            vectors[i] = vector;
+        }
+        else if (snapshot.hot_rows && snapshot.hot_rows->find(candidates[i].first, cached.data() + i * dimension))
+        {
+            vectors[i] = cached.data() + i * dimension;
+        }
+        else
+        {
+            vectors[i] = vector;
+            missed[i] = true;
+            auto address = reinterpret_cast<uintptr_t>(vector);
+            uintptr_t first_page = address / page * page;
+            ::madvise(reinterpret_cast<void *>(first_page), address + row_bytes - first_page, MADV_WILLNEED);
+        }
+    }
+
+    // Второй проход: точное сходство; страницы промахов к этому времени читаются параллельно.
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (!vectors[i])
+        {
+            // Строка удалена после приближённого этапа.
+            candidates[i].second = -std::numeric_limits<float>::infinity();
+            continue;
+        }
+        candidates[i].second = cosineSimilarity(query, vectors[i]);
+        if (missed[i] && snapshot.hot_rows)
+        {
+            snapshot.hot_rows->hit(candidates[i].first, vectors[i]);
+        }
+    }
+}
+
+float VectorDatabase::cosineSimilarity(const float *a, const float *b) const
+{
+    return dotProduct(a, b, dimension);
+}
+
+void VectorDatabase::normalizeVector(float *vector) const
+{
+    float norm = dotProduct(vector, vector, dimension);
+
+    if (norm > 0.0f)
+    {
+        norm = std::sqrt(norm);
+        for (size_t i = 0; i < dimension; ++i)
+        {
+            vector[i] /= norm;
+        }
+    }
+}
+
+bool VectorDatabase::remove(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    auto next = std::make_shared<VectorSnapshot>(*residentSnapshot());
+    auto row = findRow(*next, id);
+    if (row == invalid_row)
+    {
+        return false;
+    }
+
+    markDead(*next, row);
+    ++next->dead_rows;
+    ++rewrite_epoch;
+    modified = true;
+    publish(next);
+    scheduleCompaction(*next);
+    return true;
+}
+
+size_t VectorDatabase::removeWhere(const std::function<bool(uint64_t, std::string_view)> &filter)
+{
+    // Условие вычисляется по снимку без блокировки: оно может обращаться к этой же БД
+    // (в том числе изменять её), а под write_mutex только помечаются найденные записи.
+    auto snap = snapshot();
+    std::vector<uint64_t> ids;
+    MetadataBlock block;
+    for (size_t row = 0; row < snap->rows; ++row)
+    {
+        const auto &segment = snap->segment(row);
+        size_t offset = row % VectorSnapshot::segment_rows;
+        if (!segment.isDead(offset) && filter(segment.ids[offset], segment.text(offset, block)))
+        {
+            ids.push_back(segment.ids[offset]);
+        }
+    }
+    if (ids.empty())
+    {
+        return 0;
+    }
+
+    // Пока условие вычислялось, БД могла уплотниться или потерять часть записей:
+    // строки ищутся заново по ID, уже удалённые пропускаются.
+    std::lock_guard<std::mutex> lock(write_mutex);
+    auto next = std::make_shared<VectorSnapshot>(*residentSnapshot());
+    size_t removed = 0;
+    for (auto id : ids)
+    {
+        if (auto row = findRow(*next, id); row != invalid_row)
+        {
+            markDead(*next, row);
+            ++removed;
+        }
+    }
+    if (removed == 0)
+    {
+        return 0;
+    }
+
+    next->dead_rows += removed;
+    ++rewrite_epoch;
+    modified = true;
+    publish(next);
+    scheduleCompaction(*next);
+    return removed;
+}
+
+void VectorDatabase::markDead(const VectorSnapshot &snapshot, size_t row)
+{
+    size_t offset = row % VectorSnapshot::segment_rows;
+    snapshot.segment(row).tombstones[offset / 64].fetch_or(uint64_t(1) << (offset % 64), std::memory_order_relaxed);
+}
+
+void VectorDatabase::setCompactionThreshold(float ratio)
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    compaction_threshold = ratio;
+}
+
+void VectorDatabase::setMappingOptions(const MappingOptions &options)
+{
+    {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        mapping_options = options;
+    }
+    setLocked(options.lock);
+}
+
+MappingOptions VectorDatabase::getMappingOptions() const
 {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    return mapping_options;
 }
 
-VectorDatabase::~VectorDatabase()
+void VectorDatabase::setEmbeddingCompression(bool enabled)
 {
-    if (modified)
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (embedding_compression != enabled)
     {
-        save();
+        // Файл в прежнем формате будет перезаписан при сохранении или выгрузке.
+        residentSnapshot();
+        embedding_compression = enabled;
+        modified = true;
     }
 }
 
-bool VectorDatabase::initialize()
+bool VectorDatabase::getEmbeddingCompression() const
 {
-    fs::path new_folder = "db";
+    return embedding_compression;
+}
 
-    try
+void VectorDatabase::warmUp(bool wait)
+{
+    std::unique_lock<std::mutex> lock(write_mutex);
+    if (auto snap = std::atomic_load(&current))
     {
-        fs::create_directory(new_folder);
+        startWarmUp(*snap);
     }
-    catch (const fs::filesystem_error &e)
+    if (wait && warmup.valid())
     {
-        std::cerr << "Ошибка: " << e.what() << '\n';
+        auto pending = std::move(warmup);
+        lock.unlock();
+        pending.wait();
     }
+}
 
-    if (load())
+void VectorDatabase::startWarmUp(const VectorSnapshot &snapshot) const
+{
+    // В многоуровневом режиме полные векторы читаются по требованию: прогрев вытеснил бы другие данные.
+    if (!snapshot.mapping || !mapping_options.warm_up || mapping_options.tiered)
     {
-        std::cout << "База данных загружена: " << vectors.size() << " векторов" << std::endl;
-        return true;
+        return;
+    }
+    if (warmup.valid() && warmup.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        return;
     }
+    // Прогрев держит отображение, поэтому выгрузка БД во время прогрева безопасна.
+    warmup = std::async(std::launch::async, [mapping = snapshot.mapping]() { touchPages(*mapping); });
+}
 
-    std::ofstream file("./db/" + filename, std::ios::binary);
-    if (!file)
+bool VectorDatabase::setLocked(bool locked)
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    mapping_options.lock = locked;
+    auto snap = std::atomic_load(&current);
+    if (!snap || !snap->mapping || snap->mapping->locked == locked)
     {
-        std::cerr << "Ошибка создания файла базы данных" << std::endl;
+        return snap && snap->mapping;
+    }
+    if (locked && snap->hot_rows)
+    {
+        std::cerr << "mlock не применяется в многоуровневом режиме: " << filename << std::endl;
         return false;
     }
 
-    file.write(reinterpret_cast<const char *>(&dimension), sizeof(size_t));
-    uint32_t num_vectors = 0;
-    file.write(reinterpret_cast<const char *>(&num_vectors), sizeof(uint32_t));
-
-    std::cout << "Создана новая база данных, размерность: " << dimension << std::endl;
+    auto &mapping = *snap->mapping;
+    int result = locked ? ::mlock(mapping.address, mapping.length) : ::munlock(mapping.address, mapping.length);
+    if (result != 0)
+    {
+        std::cerr << "Ошибка " << (locked ? "mlock" : "munlock") << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    mapping.locked = locked;
     return true;
 }
 
-uint32_t VectorDatabase::addEmbedding(const std::vector<float> &embedding, const std::string &metadata)
+void VectorDatabase::setMemoryOptions(const MemoryOptions &options)
 {
-    if (embedding.size() != dimension)
+    std::atomic_store(&memory_options, std::make_shared<const MemoryOptions>(options));
+}
+
+MemoryOptions VectorDatabase::getMemoryOptions() const
+{
+    return *std::atomic_load(&memory_options);
+}
+
+bool VectorDatabase::isMapped() const
+{
+    auto snap = std::atomic_load(&current);
+    return snap && snap->mapping;
+}
+
+void VectorDatabase::scheduleCompaction(const VectorSnapshot &snapshot)
+{
+    if (compaction_threshold <= 0.0f)
     {
-        std::cerr << "Ошибка: размерность эмбеддинга (" << embedding.size() << ") не совпадает с размерностью БД ("
-                  << dimension << ")" << std::endl;
-        return 0;
+        return;
+    }
+    bool dead_rows = snapshot.dead_rows >= COMPACTION_MIN_DEAD_ROWS &&
+                     snapshot.dead_rows >= compaction_threshold * snapshot.rows;
+    bool dead_bytes = snapshot.dead_metadata_bytes >= COMPACTION_MIN_DEAD_BYTES &&
+                      snapshot.dead_metadata_bytes >= compaction_threshold * snapshot.metadata_bytes;
+    if (!dead_rows && !dead_bytes)
+    {
+        return;
+    }
+    if (compaction.valid() && compaction.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        return;
+    }
+    compaction = std::async(std::launch::async, [this]() { compact(); });
+}
+
+bool VectorDatabase::compact()
+{
+    // Эпоха читается до снимка: любое удаление после этого момента отменит результат.
+    uint64_t epoch = rewrite_epoch.load();
+    auto base = std::atomic_load(&current);
+    if (!base || (base->dead_rows == 0 && base->dead_metadata_bytes == 0))
+    {
+        return false;
     }
 
-    VectorRecord record;
-    record.id = generateId();
-    record.embedding = embedding;
-    record.metadata = metadata;
+    auto fresh = std::make_shared<VectorSnapshot>();
+    copyLiveRows(*base, 0, base->rows, *fresh);
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (epoch != rewrite_epoch.load())
+    {
+        // Данные изменились во время копирования; уплотнение повторится при следующем удалении.
+        return false;
+    }
 
-    normalizeVector(record.embedding);
+    // Строки, добавленные во время копирования, переносятся как есть: добавление не меняет эпоху.
+    auto latest = residentSnapshot();
+    copyLiveRows(*latest, base->rows, latest->rows - base->rows, *fresh);
+    fresh->next_id = latest->next_id;
+    indexRows(*fresh, 0, fresh->rows);
+    ++rewrite_epoch;
+    publish(fresh);
+    std::cout << "База данных уплотнена: " << fresh->rows << " векторов" << std::endl;
+    return true;
+}
 
-    vectors.push_back(record);
-    id_to_index[record.id] = vectors.size() - 1;
-    modified = true;
+void VectorDatabase::copyLiveRows(const VectorSnapshot &source,
+                                  size_t first_row,
+                                  size_t count,
+                                  VectorSnapshot &target) const
+{
+    size_t live = 0;
+    forEachRun(source,
+               first_row,
+               count,
+               [&](const VectorSegment &segment, size_t offset, size_t run)
+               {
+                   for (size_t j = offset; j < offset + run; ++j)
+                   {
+                       live += segment.isDead(j) ? 0 : 1;
+                   }
+               });
+    reserveRows(target, live);
 
-    std::cout << "Добавлен вектор ID: " << record.id << std::endl;
-    return record.id;
+    MetadataBlock block;
+    forEachRun(source,
+               first_row,
+               count,
+               [&](const VectorSegment &segment, size_t offset, size_t run)
+               {
+                   for (size_t j = offset; j < offset + run; ++j)
+                   {
+                       if (segment.isDead(j))
+                       {
+                           continue;
+                       }
+                       const auto &to = target.segment(target.rows);
+                       size_t to_offset = target.rows % VectorSnapshot::segment_rows;
+                       std::copy(segment.embeddings.get() + j * dimension,
+                                 segment.embeddings.get() + (j + 1) * dimension,
+                                 to.embeddings.get() + to_offset * dimension);
+                       to.ids[to_offset] = segment.ids[j];
+                       to.metadata[to_offset] = to.arena->append(segment.text(j, block));
+                       target.metadata_bytes += to.metadata[to_offset].size();
+                       ++target.rows;
+                   }
+               });
 }
 
-std::vector<std::pair<uint32_t, float>> VectorDatabase::findTopK(const std::vector<float> &query,
-                                                                 uint32_t k,
-                                                                 float similarity_threshold)
+size_t VectorDatabase::size() const
 {
+    // Выгруженная БД не загружается ради подсчёта записей.
+    auto snap = std::atomic_load(&current);
+    return snap ? snap->rows - snap->dead_rows : file_rows.load();
+}
 
-    if (query.size() != dimension)
+size_t VectorDatabase::rowCount() const
+{
+    auto snap = std::atomic_load(&current);
+    return snap ? snap->rows : file_rows.load();
+}
+
+bool VectorDatabase::save()
+{
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (!std::atomic_load(&current))
     {
-        std::cerr << "Ошибка: размерность запроса не совпадает с размерностью БД" << std::endl;
-        return {};
+        // Выгруженная БД уже совпадает с файлом.
+        return true;
     }
+    return saveLocked();
+}
 
-    if (vectors.empty())
+bool VectorDatabase::saveLocked()
+{
+    auto snap = std::atomic_load(&current);
+    if (snap->dead_rows > 0)
     {
-        return {};
+        auto fresh = std::make_shared<VectorSnapshot>();
+        copyLiveRows(*snap, 0, snap->rows, *fresh);
+        fresh->next_id = snap->next_id;
+        indexRows(*fresh, 0, fresh->rows);
+        ++rewrite_epoch;
+        publish(fresh);
+        snap = fresh;
     }
 
-    std::vector<float> normalized_query = query;
-    normalizeVector(normalized_query);
+    if (!writeFile(*snap, filePath()))
+    {
+        std::cerr << "Ошибка сохранения базы данных" << std::endl;
+        return false;
+    }
 
-    std::vector<std::pair<uint32_t, float>> similarities;
+    modified = false;
+    std::cout << "База данных сохранена: " << snap->rows << " векторов" << std::endl;
+    return true;
+}
 
-    for (const auto &record : vectors)
+bool VectorDatabase::writeFile(const VectorSnapshot &snapshot, const std::string &path) const
+{
+    // Усечение отображённого файла сделало бы страницы отображения недействительными (SIGBUS).
+    std::string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    if (!file)
     {
-        float similarity = cosineSimilarity(normalized_query, record.embedding);
+        return false;
+    }
 
-        if (similarity >= similarity_threshold)
+    FileHeader header{};
+    std::copy(std::begin(file_magic), std::end(file_magic), header.magic);
+    header.version = file_version;
+    header.dimension = dimension;
+    header.count = snapshot.rows;
+    header.next_id = snapshot.next_id;
+    header.ids_offset = sizeof(FileHeader);
+    header.embeddings_offset = alignUp(header.ids_offset + header.count * sizeof(uint64_t), 64);
+    header.metadata_offset = header.embeddings_offset + header.count * dimension * sizeof(float);
+
+    // Сегменты сжимаются независимо, поэтому параллельно.
+    std::vector<std::string> embedding_blocks;
+    std::vector<uint64_t> embedding_offsets;
+    bool compress_embeddings = embedding_compression;
+    if (compress_embeddings)
+    {
+        header.flags |= flag_packed_embeddings;
+        embedding_blocks.resize((snapshot.rows + VectorSnapshot::segment_rows - 1) / VectorSnapshot::segment_rows);
+        std::atomic<size_t> next_segment{0};
+        auto encode = [&]()
+        {
+            for (size_t index = next_segment++; index < embedding_blocks.size(); index = next_segment++)
+            {
+                size_t first = index * VectorSnapshot::segment_rows;
+                size_t rows = std::min(VectorSnapshot::segment_rows, snapshot.rows - first);
+                embedding_codec::encode(
+                    snapshot.segments[index]->embeddings.get(), rows, dimension, embedding_blocks[index]);
+            }
+        };
+        size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min(n_threads, embedding_blocks.size()); ++i)
+        {
+            workers.emplace_back(encode);
+        }
+        encode();
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+
+        embedding_offsets.push_back(0);
+        for (const auto &block : embedding_blocks)
         {
-            similarities.push_back(std::make_pair(record.id, similarity));
+            embedding_offsets.push_back(embedding_offsets.back() + block.size());
         }
+        header.metadata_offset =
+            header.embeddings_offset + embedding_offsets.size() * sizeof(uint64_t) + embedding_offsets.back();
     }
 
-    std::sort(
-        similarities.begin(),
-        similarities.end(),
-        [](const std::pair<uint32_t, float> &a, const std::pair<uint32_t, float> &b) { return a.second > b.second; });
+    std::vector<uint64_t> metadata_offsets(snapshot.rows + 1, 0);
+    for (size_t row = 0; row < snapshot.rows; ++row)
+    {
+        metadata_offsets[row + 1] =
+            metadata_offsets[row] + snapshot.segment(row).textSize(row % VectorSnapshot::segment_rows);
+    }
 
-    if (k > similarities.size())
+    // Блоки сжимаются до записи: таблица блоков в файле стоит перед ними.
+    std::vector<uint64_t> block_table;
+    std::string packed;
+    std::string text;
+    MetadataBlock block;
+    for (size_t first = 0; first < snapshot.rows; first += VectorSnapshot::segment_rows)
     {
-        k = static_cast<uint32_t>(similarities.size());
+        const auto &segment = snapshot.segment(first);
+        size_t rows = std::min(VectorSnapshot::segment_rows, snapshot.rows - first);
+        if (segment.packed && segment.packed->rows() == rows)
+        {
+            // Сегмент без изменений с загрузки: блоки переносятся без пересжатия.
+            for (size_t index = 0; index < segment.packed->blocks(); ++index)
+            {
+                block_table.push_back(first + segment.packed->blockRow(index));
+                block_table.push_back(packed.size());
+                packed.append(segment.packed->packedBlock(index));
+            }
+            continue;
+        }
+
+        for (size_t begin = 0, end = 0; begin < rows; begin = end)
+        {
+            text.clear();
+            do
+            {
+                text.append(segment.text(end, block));
+                ++end;
+            } while (end < rows && text.size() + segment.textSize(end) <= METADATA_BLOCK_BYTES);
+            block_table.push_back(first + begin);
+            block_table.push_back(packed.size());
+            PackedMetadata::packBlock(text, packed);
+        }
+    }
+    block_table.push_back(snapshot.rows);
+    block_table.push_back(packed.size());
+    uint64_t block_count = block_table.size() / 2 - 1;
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    forEachRun(snapshot,
+               0,
+               snapshot.rows,
+               [&](const VectorSegment &segment, size_t offset, size_t run)
+               { file.write(reinterpret_cast<const char *>(segment.ids.get() + offset), run * sizeof(uint64_t)); });
+    std::vector<char> padding(header.embeddings_offset - header.ids_offset - header.count * sizeof(uint64_t), 0);
+    file.write(padding.data(), padding.size());
+    if (compress_embeddings)
+    {
+        file.write(reinterpret_cast<const char *>(embedding_offsets.data()),
+                   embedding_offsets.size() * sizeof(uint64_t));
+        for (const auto &block : embedding_blocks)
+        {
+            file.write(block.data(), block.size());
+        }
+    }
+    else
+    {
+        forEachRun(snapshot,
+                   0,
+                   snapshot.rows,
+                   [&](const VectorSegment &segment, size_t offset, size_t run)
+                   {
+                       file.write(reinterpret_cast<const char *>(segment.embeddings.get() + offset * dimension),
+                                  run * dimension * sizeof(float));
+                   });
+    }
+    file.write(reinterpret_cast<const char *>(metadata_offsets.data()), metadata_offsets.size() * sizeof(uint64_t));
+    file.write(reinterpret_cast<const char *>(&block_count), sizeof(block_count));
+    file.write(reinterpret_cast<const char *>(block_table.data()), block_table.size() * sizeof(uint64_t));
+    file.write(packed.data(), packed.size());
+    file.close();
+    // Без fsync после сбоя питания переименование может оказаться на диске раньше данных.
+    if (!file || !syncPath(temp_path))
+    {
+        return false;
     }
 
-    return std::vector<std::pair<uint32_t, float>>(similarities.begin(), similarities.begin() + k);
+    std::error_code error;
+    fs::rename(temp_path, path, error);
+    if (error)
+    {
+        return false;
+    }
+    // Запись каталога фиксирует само переименование; её ошибка не делает файл неверным.
+    auto directory = fs::path(path).parent_path();
+    syncPath(directory.empty() ? "." : directory.string());
+    return true;
 }
 
-float VectorDatabase::cosineSimilarity(const std::vector<float> &a, const std::vector<float> &b) const
+bool VectorDatabase::load()
 {
-    float dot_product = 0.0f;
-    for (size_t i = 0; i < a.size(); ++i)
+    bool legacy = false;
+    auto loaded = readFile(legacy, getMappingOptions());
+    if (!loaded)
     {
-        dot_product += a[i] * b[i];
+        return false;
     }
-    return dot_product;
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    // Файл старого формата будет перезаписан в новом формате при следующем сохранении.
+    modified = legacy && loaded->rows > 0;
+    ++rewrite_epoch;
+    publish(loaded);
+    startWarmUp(*loaded);
+    return true;
 }
 
-void VectorDatabase::normalizeVector(std::vector<float> &vector) const
+std::shared_ptr<VectorSnapshot> VectorDatabase::readFile(bool &legacy, const MappingOptions &options) const
 {
-    float norm = 0.0f;
-    for (float value : vector)
+    std::ifstream file(filePath(), std::ios::binary);
+    if (!file)
     {
-        norm += value * value;
+        return nullptr;
     }
 
-    if (norm > 0.0f)
+    auto loaded = std::make_shared<VectorSnapshot>();
+    FileHeader header{};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    legacy = !file || !std::equal(std::begin(file_magic), std::end(file_magic), header.magic);
+    if (legacy)
     {
-        norm = std::sqrt(norm);
-        for (float &value : vector)
+        file.clear();
+        file.seekg(0);
+        if (!loadLegacy(file, *loaded))
         {
-            value /= norm;
+            return nullptr;
         }
     }
-}
+    else
+    {
+        if (header.version != file_version && header.version != file_version_plain)
+        {
+            std::cerr << "Ошибка: неподдерживаемая версия файла БД: " << header.version << std::endl;
+            return nullptr;
+        }
+        if (header.flags & ~flag_packed_embeddings)
+        {
+            std::cerr << "Ошибка: неподдерживаемые флаги файла БД: " << header.flags << std::endl;
+            return nullptr;
+        }
+        if (header.dimension != dimension)
+        {
+            std::cerr << "Ошибка: размерность в файле не совпадает с ожидаемой" << std::endl;
+            return nullptr;
+        }
+        bool packed_embeddings = header.flags & flag_packed_embeddings;
+        if (!validSections(header, fileSize(filePath()), packed_embeddings))
+        {
+            std::cerr << "Ошибка: файл БД повреждён (секции не помещаются в файл)" << std::endl;
+            return nullptr;
+        }
 
-uint32_t VectorDatabase::generateId() const
-{
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<uint32_t> dis(1000, 9999999);
+        EmbeddingSection embeddings;
+        embeddings.offset = header.embeddings_offset;
+        if (packed_embeddings && !readEmbeddingTable(file, header.count, header.metadata_offset, embeddings))
+        {
+            std::cerr << "Ошибка: файл БД повреждён" << std::endl;
+            return nullptr;
+        }
+        MetadataSection metadata;
+        metadata.offsets.assign(header.count + 1, 0);
+        file.seekg(static_cast<std::streamoff>(header.metadata_offset));
+        file.read(reinterpret_cast<char *>(metadata.offsets.data()), metadata.offsets.size() * sizeof(uint64_t));
+        metadata.blob_offset = header.metadata_offset + metadata.offsets.size() * sizeof(uint64_t);
+        bool packed = header.version == file_version;
+        if (!file || metadata.offsets.front() != 0 ||
+            !std::is_sorted(metadata.offsets.begin(), metadata.offsets.end()) ||
+            (packed ? !readBlockTable(file, metadata)
+                    : metadata.blob_offset + metadata.offsets.back() > fileSize(filePath())))
+        {
+            std::cerr << "Ошибка: файл БД повреждён" << std::endl;
+            return nullptr;
+        }
+        file.close();
+
+        // Сжатые метаданные читаются по требованию, поэтому в режиме mmap отображаются вместе с векторами.
+        // Сжатые эмбеддинги нельзя читать со страниц файла: такой файл всегда загружается в кучу.
+        uint64_t metadata_end = metadata.blob_offset + (packed ? metadata.block_offsets.back() : 0);
+        if ((options.enabled || options.tiered) && header.count > 0 && !packed_embeddings)
+        {
+            loaded->mapping = mapFile(filePath(), packed ? metadata_end : header.metadata_offset, options);
+        }
+        bool tiered = options.tiered && loaded->mapping;
+        if (loaded->mapping)
+        {
+            // Полные сегменты и последний сегмент точного размера ссылаются на страницы файла;
+            // новые строки попадут в копию последнего сегмента или в новый сегмент.
+            const char *base = static_cast<const char *>(loaded->mapping->address);
+            auto ids = reinterpret_cast<const uint64_t *>(base + header.ids_offset);
+            auto embeddings = reinterpret_cast<const float *>(base + header.embeddings_offset);
+            for (size_t first = 0; first < header.count; first += VectorSnapshot::segment_rows)
+            {
+                auto segment = emptySegment(std::min<size_t>(VectorSnapshot::segment_rows, header.count - first));
+                segment->ids = std::shared_ptr<uint64_t[]>(loaded->mapping, const_cast<uint64_t *>(ids + first));
+                segment->embeddings =
+                    std::shared_ptr<float[]>(loaded->mapping, const_cast<float *>(embeddings + first * dimension));
+                if (tiered)
+                {
+                    segment->quantized = std::make_shared<QuantizedRows>(segment->capacity, dimension);
+                }
+                loaded->segments.push_back(std::move(segment));
+            }
+            if (tiered)
+            {
+                loaded->hot_rows = std::make_shared<HotRowCache>(
+                    std::min<size_t>(options.hot_rows, header.count / HOT_ROWS_DIVISOR), dimension);
+            }
+        }
+        else
+        {
+            reserveRows(*loaded, header.count);
+        }
+        bool read_vectors = !loaded->mapping;
+        uint64_t row_bytes = read_vectors ? sizeof(uint64_t) + dimension * sizeof(float)
+                             : tiered     ? dimension * sizeof(float)
+                                          : 0;
+        load_done = 0;
+        load_total = header.count * row_bytes +
+                     (!packed ? metadata.offsets[header.count] : read_vectors ? metadata.block_offsets.back() : 0);
+
+        // Большой файл читается параллельно диапазонами строк, кратными сегменту.
+        size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+        n_threads = std::max<size_t>(1, std::min<size_t>(n_threads, load_total / PARALLEL_MIN_LOAD_BYTES));
+        size_t per_thread = (header.count + n_threads - 1) / n_threads;
+        per_thread = alignUp(std::max<size_t>(per_thread, 1), VectorSnapshot::segment_rows);
+
+        std::atomic<bool> ok{true};
+        auto read_range = [&](size_t begin)
+        {
+            size_t count = std::min<size_t>(per_thread, header.count - begin);
+            // Исключение в потоке загрузки завершило бы процесс: оно превращается в ошибку загрузки.
+            try
+            {
+                if (!readRows(header.ids_offset, embeddings, metadata, *loaded, begin, count, read_vectors))
+                {
+                    ok = false;
+                }
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Ошибка чтения файла БД: " << e.what() << std::endl;
+                ok = false;
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t begin = per_thread; begin < header.count; begin += per_thread)
+        {
+            workers.emplace_back(read_range, begin);
+        }
+        read_range(0);
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+
+        if (!ok)
+        {
+            std::cerr << "Ошибка: файл БД повреждён" << std::endl;
+            return nullptr;
+        }
+
+        // Индекс занимает память до наибольшего ID, поэтому ID проверяются до индексации:
+        // они выдаются по возрастанию и меньше next_id.
+        uint64_t previous_id = 0;
+        for (size_t row = 0; row < header.count; ++row)
+        {
+            uint64_t id = loaded->segment(row).ids[row % VectorSnapshot::segment_rows];
+            if (id <= previous_id || id >= header.next_id)
+            {
+                std::cerr << "Ошибка: файл БД повреждён (неверный ID записи)" << std::endl;
+                return nullptr;
+            }
+            previous_id = id;
+        }
+
+        // Файл остаётся в своём формате при следующих сохранениях.
+        embedding_compression = packed_embeddings;
+        loaded->rows = header.count;
+        loaded->next_id = header.next_id;
+        loaded->metadata_bytes = metadata.offsets[header.count];
+        if (packed)
+        {
+            loaded->metadata_bytes = 0;
+            for (const auto &segment : loaded->segments)
+            {
+                loaded->metadata_bytes += segment->packed->memoryUsage();
+            }
+        }
+    }
 
-    return dis(gen);
+    indexRows(*loaded, 0, loaded->rows);
+    return loaded;
 }
 
-bool VectorDatabase::save()
+bool VectorDatabase::readRows(uint64_t ids_offset,
+                              const EmbeddingSection &embeddings,
+                              const MetadataSection &metadata,
+                              VectorSnapshot &snapshot,
+                              size_t first_row,
+                              size_t count,
+                              bool read_vectors) const
 {
-    std::ofstream file("./db/" + filename, std::ios::binary | std::ios::trunc);
-    if (!file)
+    std::ifstream file(filePath(), std::ios::binary);
+    if (!file || count == 0)
     {
-        std::cerr << "Ошибка сохранения базы данных" << std::endl;
-        return false;
+        return static_cast<bool>(file);
     }
 
-    file.write(reinterpret_cast<const char *>(&dimension), sizeof(size_t));
-    uint32_t num_vectors = static_cast<uint32_t>(vectors.size());
-    file.write(reinterpret_cast<const char *>(&num_vectors), sizeof(uint32_t));
-
-    for (const auto &record : vectors)
+    if (read_vectors)
     {
-        file.write(reinterpret_cast<const char *>(&record.id), sizeof(uint32_t));
+        file.seekg(static_cast<std::streamoff>(ids_offset + first_row * sizeof(uint64_t)));
+        forEachRun(snapshot,
+                   first_row,
+                   count,
+                   [&](const VectorSegment &segment, size_t offset, size_t run)
+                   {
+                       file.read(reinterpret_cast<char *>(segment.ids.get() + offset), run * sizeof(uint64_t));
+                       load_done += run * sizeof(uint64_t);
+                   });
 
-        uint32_t metadata_size = static_cast<uint32_t>(record.metadata.size());
-        file.write(reinterpret_cast<const char *>(&metadata_size), sizeof(uint32_t));
-        if (metadata_size > 0)
+        if (!embeddings.block_offsets.empty())
+        {
+            if (!readPackedEmbeddings(file, embeddings, snapshot, first_row, count))
+            {
+                return false;
+            }
+        }
+        else
         {
-            file.write(record.metadata.c_str(), metadata_size);
+            file.seekg(static_cast<std::streamoff>(embeddings.offset + first_row * dimension * sizeof(float)));
+            forEachRun(snapshot,
+                       first_row,
+                       count,
+                       [&](const VectorSegment &segment, size_t offset, size_t run)
+                       {
+                           file.read(reinterpret_cast<char *>(segment.embeddings.get() + offset * dimension),
+                                     run * dimension * sizeof(float));
+                           load_done += run * dimension * sizeof(float);
+                       });
         }
+    }
+    else if (snapshot.segment(first_row).quantized)
+    {
+        // Полные векторы остаются в файле: они читаются последовательно только для int8-копии.
+        std::vector<float> buffer;
+        file.seekg(static_cast<std::streamoff>(embeddings.offset + first_row * dimension * sizeof(float)));
+        forEachRun(snapshot,
+                   first_row,
+                   count,
+                   [&](const VectorSegment &segment, size_t offset, size_t run)
+                   {
+                       buffer.resize(run * dimension);
+                       file.read(reinterpret_cast<char *>(buffer.data()), buffer.size() * sizeof(float));
+                       quantization::quantizeRows(buffer.data(),
+                                                  run,
+                                                  dimension,
+                                                  segment.quantized->codes.get() + offset * dimension,
+                                                  segment.quantized->scales.get() + offset);
+                       load_done += run * dimension * sizeof(float);
+                   });
+    }
 
-        file.write(reinterpret_cast<const char *>(record.embedding.data()), sizeof(float) * dimension);
+    if (!metadata.block_rows.empty())
+    {
+        readPackedRows(file, metadata, snapshot, first_row, count);
+        return static_cast<bool>(file);
     }
 
-    modified = false;
-    std::cout << "База данных сохранена: " << vectors.size() << " векторов" << std::endl;
+    // Тексты отрезка читаются одним вызовом в один блок хранилища сегмента.
+    const auto &metadata_offsets = metadata.offsets;
+    file.seekg(static_cast<std::streamoff>(metadata.blob_offset + metadata_offsets[first_row]));
+    size_t row = first_row;
+    forEachRun(snapshot,
+               first_row,
+               count,
+               [&](const VectorSegment &segment, size_t offset, size_t run)
+               {
+                   uint64_t base = metadata_offsets[row];
+                   size_t bytes = metadata_offsets[row + run] - base;
+                   char *texts = segment.arena->allocate(bytes);
+                   file.read(texts, bytes);
+                   for (size_t j = 0; j < run; ++j, ++row)
+                   {
+                       segment.metadata[offset + j] = std::string_view(
+                           texts + (metadata_offsets[row] - base), metadata_offsets[row + 1] - metadata_offsets[row]);
+                   }
+                   load_done += bytes;
+               });
+    return static_cast<bool>(file);
+}
+
+bool VectorDatabase::readPackedEmbeddings(std::ifstream &file,
+                                          const EmbeddingSection &embeddings,
+                                          VectorSnapshot &snapshot,
+                                          size_t first_row,
+                                          size_t count) const
+{
+    // Диапазоны загрузки кратны сегменту, поэтому каждый блок распаковывается целиком одним потоком.
+    std::string block;
+    for (size_t first = first_row; first < first_row + count; first += VectorSnapshot::segment_rows)
+    {
+        size_t index = first / VectorSnapshot::segment_rows;
+        size_t rows = std::min(VectorSnapshot::segment_rows, first_row + count - first);
+        block.resize(embeddings.block_offsets[index + 1] - embeddings.block_offsets[index]);
+        file.seekg(static_cast<std::streamoff>(embeddings.offset + embeddings.block_offsets[index]));
+        file.read(block.data(), block.size());
+        if (!file ||
+            !embedding_codec::decode(
+                block.data(), block.size(), snapshot.segments[index]->embeddings.get(), rows, dimension))
+        {
+            std::cerr << "Ошибка: повреждён блок эмбеддингов " << index << std::endl;
+            return false;
+        }
+        load_done += rows * dimension * sizeof(float);
+    }
     return true;
 }
 
-bool VectorDatabase::load()
+bool VectorDatabase::readEmbeddingTable(std::ifstream &file,
+                                        uint64_t count,
+                                        uint64_t metadata_offset,
+                                        EmbeddingSection &embeddings)
+{
+    uint64_t segments = (count + VectorSnapshot::segment_rows - 1) / VectorSnapshot::segment_rows;
+    auto &block_offsets = embeddings.block_offsets;
+    block_offsets.assign(segments + 1, 0);
+    file.seekg(static_cast<std::streamoff>(embeddings.offset));
+    file.read(reinterpret_cast<char *>(block_offsets.data()), block_offsets.size() * sizeof(uint64_t));
+    embeddings.offset += block_offsets.size() * sizeof(uint64_t);
+    return file && block_offsets.front() == 0 && std::is_sorted(block_offsets.begin(), block_offsets.end()) &&
+           embeddings.offset + block_offsets.back() == metadata_offset;
+}
+
+bool VectorDatabase::readBlockTable(std::ifstream &file, MetadataSection &metadata)
 {
-    std::ifstream file(filename, std::ios::binary);
+    uint64_t count = metadata.offsets.size() - 1;
+    uint64_t block_count = 0;
+    file.read(reinterpret_cast<char *>(&block_count), sizeof(block_count));
+    if (!file || block_count > count)
+    {
+        return false;
+    }
+    std::vector<uint64_t> table(2 * (block_count + 1));
+    file.read(reinterpret_cast<char *>(table.data()), table.size() * sizeof(uint64_t));
     if (!file)
     {
         return false;
     }
+    metadata.blob_offset += sizeof(block_count) + table.size() * sizeof(uint64_t);
 
+    auto &block_rows = metadata.block_rows;
+    auto &block_offsets = metadata.block_offsets;
+    for (size_t i = 0; i <= block_count; ++i)
+    {
+        block_rows.push_back(table[2 * i]);
+        block_offsets.push_back(table[2 * i + 1]);
+    }
+    if (block_rows.front() != 0 || block_offsets.front() != 0 || block_rows.back() != count)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < block_count; ++i)
+    {
+        uint64_t first = block_rows[i];
+        uint64_t last = block_rows[i + 1];
+        if (last <= first || first / VectorSnapshot::segment_rows != (last - 1) / VectorSnapshot::segment_rows ||
+            block_offsets[i + 1] < block_offsets[i] ||
+            block_offsets[i + 1] - block_offsets[i] > metadata.offsets[last] - metadata.offsets[first] ||
+            metadata.offsets[last] - metadata.offsets[first] > (block_offsets[i + 1] - block_offsets[i]) * LZ_MAX_RATIO)
+        {
+            return false;
+        }
+    }
+
+    file.seekg(0, std::ios::end);
+    return file && static_cast<uint64_t>(file.tellg()) >= metadata.blob_offset + block_offsets.back();
+}
+
+void VectorDatabase::readPackedRows(std::ifstream &file,
+                                    const MetadataSection &metadata,
+                                    VectorSnapshot &snapshot,
+                                    size_t first_row,
+                                    size_t count) const
+{
+    const auto &block_rows = metadata.block_rows;
+    const auto &block_offsets = metadata.block_offsets;
+    for (size_t first = first_row; first < first_row + count; first += VectorSnapshot::segment_rows)
+    {
+        size_t rows = std::min(VectorSnapshot::segment_rows, first_row + count - first);
+        // Границы сегментов совпадают с границами блоков (проверено readBlockTable).
+        size_t begin = std::lower_bound(block_rows.begin(), block_rows.end(), first) - block_rows.begin();
+        size_t end = std::lower_bound(block_rows.begin(), block_rows.end(), first + rows) - block_rows.begin();
+
+        std::vector<uint64_t> offsets(metadata.offsets.begin() + first, metadata.offsets.begin() + first + rows + 1);
+        for (auto &offset : offsets)
+        {
+            offset -= metadata.offsets[first];
+        }
+        std::vector<uint64_t> rows_of_blocks(block_rows.begin() + begin, block_rows.begin() + end + 1);
+        for (auto &row : rows_of_blocks)
+        {
+            row -= first;
+        }
+        std::vector<uint64_t> offsets_of_blocks(block_offsets.begin() + begin, block_offsets.begin() + end + 1);
+        for (auto &offset : offsets_of_blocks)
+        {
+            offset -= block_offsets[begin];
+        }
+
+        uint64_t position = metadata.blob_offset + block_offsets[begin];
+        std::shared_ptr<const char> data;
+        if (snapshot.mapping)
+        {
+            data = std::shared_ptr<const char>(snapshot.mapping,
+                                               static_cast<const char *>(snapshot.mapping->address) + position);
+        }
+        else
+        {
+            size_t bytes = offsets_of_blocks.back();
+            std::shared_ptr<char[]> buffer(new char[bytes]);
+            file.seekg(static_cast<std::streamoff>(position));
+            file.read(buffer.get(), bytes);
+            data = std::shared_ptr<const char>(buffer, buffer.get());
+            load_done += bytes;
+        }
+
+        // Снимок ещё не опубликован, сегменты принадлежат только ему.
+        auto &segment = const_cast<VectorSegment &>(snapshot.segment(first));
+        segment.packed = std::make_shared<PackedMetadata>(
+            std::move(offsets), std::move(rows_of_blocks), std::move(offsets_of_blocks), std::move(data));
+    }
+}
+
+bool VectorDatabase::loadLegacy(std::ifstream &file, VectorSnapshot &snapshot) const
+{
     size_t file_dimension;
     file.read(reinterpret_cast<char *>(&file_dimension), sizeof(size_t));
 
@@ -214,57 +2001,127 @@ bool VectorDatabase::load()
     uint32_t num_vectors;
     file.read(reinterpret_cast<char *>(&num_vectors), sizeof(uint32_t));
 
-    vectors.clear();
-    vectors.reserve(num_vectors);
-    id_to_index.clear();
+    // Каждая запись занимает не меньше ID, длины метаданных и вектора.
+    uint64_t remaining = fileSize(filePath());
+    remaining -= std::min<uint64_t>(remaining, sizeof(size_t) + sizeof(uint32_t));
+    if (!file || num_vectors > remaining / (2 * sizeof(uint32_t) + dimension * sizeof(float)))
+    {
+        std::cerr << "Ошибка: файл БД повреждён" << std::endl;
+        return false;
+    }
 
+    reserveRows(snapshot, num_vectors);
     for (uint32_t i = 0; i < num_vectors; ++i)
     {
-        VectorRecord record;
+        const auto &segment = snapshot.segment(i);
+        size_t offset = i % VectorSnapshot::segment_rows;
 
-        file.read(reinterpret_cast<char *>(&record.id), sizeof(uint32_t));
+        // Старые случайные ID не сохраняются: записи получают новые ID по порядку.
+        uint32_t legacy_id;
+        file.read(reinterpret_cast<char *>(&legacy_id), sizeof(uint32_t));
+        segment.ids[offset] = i + 1;
 
-        // ����������
+        // Метаданные
         uint32_t metadata_size;
         file.read(reinterpret_cast<char *>(&metadata_size), sizeof(uint32_t));
+        if (!file || metadata_size > remaining)
+        {
+            std::cerr << "Ошибка: файл БД повреждён" << std::endl;
+            return false;
+        }
         if (metadata_size > 0)
         {
-            record.metadata.resize(metadata_size);
-            file.read(&record.metadata[0], metadata_size);
+            char *text = segment.arena->allocate(metadata_size);
+            file.read(text, metadata_size);
+            segment.metadata[offset] = std::string_view(text, metadata_size);
+            snapshot.metadata_bytes += metadata_size;
         }
 
-        // ������
-        record.embedding.resize(dimension);
-        file.read(reinterpret_cast<char *>(record.embedding.data()), sizeof(float) * dimension);
-
-        vectors.push_back(record);
-        id_to_index[record.id] = vectors.size() - 1;
+        // Вектор
+        file.read(reinterpret_cast<char *>(segment.embeddings.get() + offset * dimension), sizeof(float) * dimension);
+    }
+    if (!file)
+    {
+        std::cerr << "Ошибка: файл БД повреждён" << std::endl;
+        return false;
     }
 
-    modified = false;
+    snapshot.rows = num_vectors;
+    snapshot.next_id = uint64_t(num_vectors) + 1;
     return true;
 }
 
-std::string VectorDatabase::getMetadata(uint32_t id) const
+std::string VectorDatabase::getMetadata(uint64_t id) const
+{
+    auto snap = snapshot();
+    MetadataBlock block;
+    return std::string(getMetadata(*snap, id, block));
+}
+
+std::string_view VectorDatabase::getMetadata(const VectorSnapshot &snapshot, uint64_t id, MetadataBlock &block)
+{
+    if (auto row = findRow(snapshot, id); row != invalid_row)
+    {
+        return snapshot.segment(row).text(row % VectorSnapshot::segment_rows, block);
+    }
+    return {};
+}
+
+size_t VectorDatabase::getPosition(uint64_t id) const
+{
+    return getPosition(*snapshot(), id);
+}
+
+size_t VectorDatabase::getPosition(const VectorSnapshot &snapshot, uint64_t id)
 {
-    auto it = id_to_index.find(id);
-    if (it != id_to_index.end() && it->second < vectors.size())
+    if (auto row = findRow(snapshot, id); row != invalid_row)
     {
-        return vectors[it->second].metadata;
+        return row;
     }
-    return "";
+    return snapshot.rows;
 }
 
-bool VectorDatabase::updateMetadata(uint32_t id, const std::string &new_metadata)
+bool VectorDatabase::updateMetadata(uint64_t id, const std::string &new_metadata)
 {
-    auto it = id_to_index.find(id);
-    if (it != id_to_index.end() && it->second < vectors.size())
+    std::lock_guard<std::mutex> lock(write_mutex);
+    auto next = std::make_shared<VectorSnapshot>(*residentSnapshot());
+    auto row = findRow(*next, id);
+    if (row == invalid_row)
     {
-        vectors[it->second].metadata = new_metadata;
-        modified = true;
-        return true;
+        return false;
     }
-    return false;
+
+    // Копирование при записи: читатели старого снимка продолжают видеть прежние метаданные.
+    size_t index = row / VectorSnapshot::segment_rows;
+    const auto &old_segment = *next->segments[index];
+    size_t used = std::min(old_segment.capacity, next->rows - index * VectorSnapshot::segment_rows);
+    auto segment = std::make_shared<VectorSegment>(old_segment);
+    segment->metadata.reset(new std::string_view[old_segment.capacity]);
+    std::copy(old_segment.metadata.get(), old_segment.metadata.get() + used, segment->metadata.get());
+    if (segment->packed)
+    {
+        // Изменённый сегмент хранит тексты без сжатия; при сохранении он будет сжат заново.
+        MetadataBlock block;
+        for (size_t offset = 0; offset < segment->packed->rows(); ++offset)
+        {
+            segment->metadata[offset] = segment->arena->append(segment->packed->text(offset, block));
+            next->metadata_bytes += segment->metadata[offset].size();
+        }
+        next->metadata_bytes -= segment->packed->memoryUsage();
+        segment->packed.reset();
+    }
+    // Прежний текст остаётся в хранилище до уплотнения: его ещё могут читать старые снимки.
+    auto &text = segment->metadata[row % VectorSnapshot::segment_rows];
+    next->metadata_bytes = next->metadata_bytes - text.size() + new_metadata.size();
+    next->dead_metadata_bytes += text.size();
+    text = segment->arena->append(new_metadata);
+    next->segments[index] = std::move(segment);
+
+    ++rewrite_epoch;
+    modified = true;
+    publish(next);
+    scheduleCompaction(*next);
+    return true;
 }
     const std::string& VectorDatabase::getFilename() const{
         return filename;
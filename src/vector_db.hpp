@@ -1,9 +1,21 @@
 #ifndef VECTOR_DB_H
 #define VECTOR_DB_H
 
+#include "hot_row_cache.hpp"
+#include "memory_placement.hpp"
+#include "metadata_arena.hpp"
+#include "packed_metadata.hpp"
+#include "quantized_rows.hpp"
+#include <atomic>
 #include <cstdint>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 
 
@@ -15,25 +27,168 @@
  */
 struct VectorRecord
 {
-    uint32_t id;                  ///< Уникальный идентификатор записи.
+    uint64_t id;                  ///< Уникальный идентификатор записи.
     std::vector<float> embedding; ///< Векторное представление (эмбеддинг).
     std::string metadata;         ///< Метаданные, ассоциированные с записью.
 };
 
+/**
+ * @brief Сегмент строк БД фиксированной ёмкости.
+ *
+ * Строки, видимые в опубликованном снимке, больше не изменяются: новые строки пишутся
+ * за границей снимка, правка метаданных копирует массив метаданных сегмента.
+ * Исключение - битовая карта удалённых строк, она общая и атомарная.
+ *
+ * Тексты метаданных лежат в общем хранилище сегмента, строки ссылаются на них через
+ * std::string_view: загрузка и освобождение выполняются крупными блоками. Строки,
+ * загруженные из файла, хранят метаданные сжатыми блоками (packed) и распаковываются
+ * при обращении.
+ *
+ * В многоуровневом режиме эмбеддинги сегмента отображены из файла, а в памяти держится
+ * только их int8-копия (quantized) для приближённого этапа поиска.
+ */
+struct VectorSegment
+{
+    size_t capacity = 0;                                 ///< Ёмкость сегмента в строках.
+    std::shared_ptr<float[]> embeddings;                 ///< Нормализованные эмбеддинги (capacity x dimension).
+    std::shared_ptr<uint64_t[]> ids;                     ///< ID записей.
+    std::shared_ptr<std::string_view[]> metadata;        ///< Метаданные записей (тексты в arena).
+    std::shared_ptr<MetadataArena> arena;                ///< Хранилище текстов метаданных.
+    std::shared_ptr<const PackedMetadata> packed;        ///< Сжатые метаданные первых packed->rows() строк.
+    std::shared_ptr<const QuantizedRows> quantized;      ///< int8-копия эмбеддингов (многоуровневый режим).
+    std::shared_ptr<std::atomic<uint64_t>[]> tombstones; ///< Битовая карта удалённых строк.
+
+    bool isDead(size_t offset) const
+    {
+        return (tombstones[offset / 64].load(std::memory_order_relaxed) >> (offset % 64)) & 1;
+    }
+
+    bool isPacked(size_t offset) const
+    {
+        return packed && offset < packed->rows();
+    }
+
+    /**
+     * @brief Текст метаданных строки; для сжатой строки действителен, пока удерживается block.
+     */
+    std::string_view text(size_t offset, MetadataBlock &block) const
+    {
+        return isPacked(offset) ? packed->text(offset, block) : metadata[offset];
+    }
+
+    size_t textSize(size_t offset) const
+    {
+        return isPacked(offset) ? packed->textSize(offset) : metadata[offset].size();
+    }
+};
+
+/**
+ * @brief Отображение файла БД в память (определено в vector_db.cpp).
+ */
+struct MappedFile;
+
+/**
+ * @brief Параметры отображения файла БД в память.
+ */
+struct MappingOptions
+{
+    bool enabled = false;    ///< Отображать ID и эмбеддинги из файла (mmap) вместо чтения в кучу.
+    bool populate = false;   ///< MAP_POPULATE: заполнить страницы сразу при отображении.
+    bool huge_pages = false; ///< madvise(MADV_HUGEPAGE) для отображения.
+    bool lock = false;       ///< mlock: закрепить страницы в памяти (не применяется в многоуровневом режиме).
+    bool warm_up = true;     ///< Прогревать страницы в фоне после отображения.
+    /// Многоуровневый режим: в памяти только int8-копия эмбеддингов, полные векторы и метаданные
+    /// читаются из отображения для кандидатов поиска. Включает отображение независимо от enabled.
+    bool tiered = false;
+    /// Наибольшая ёмкость кэша полных векторов часто находимых строк (многоуровневый режим);
+    /// фактическая ёмкость не больше 1/16 строк БД, то есть четверти int8-копии (0 - без кэша).
+    size_t hot_rows = 16384;
+};
+
+/**
+ * @brief Неизменяемый снимок состояния БД.
+ *
+ * Строка row находится в сегменте row / VectorSnapshot::segment_rows; все сегменты,
+ * кроме последнего, заполнены полностью.
+ */
+struct VectorSnapshot
+{
+    static constexpr size_t segment_rows = 4096; ///< Ёмкость полного сегмента.
+    static constexpr size_t index_chunk = 4096;  ///< Количество ID в одном блоке индекса.
+
+    std::vector<std::shared_ptr<const VectorSegment>> segments;
+    std::vector<std::shared_ptr<size_t[]>> index; ///< Строка записи по ID блоками по index_chunk.
+    size_t rows = 0;                              ///< Количество строк, включая удалённые.
+    size_t dead_rows = 0;                         ///< Количество удалённых, но ещё не вычищенных строк.
+    size_t metadata_bytes = 0;                    ///< Суммарная длина метаданных (для оценки памяти).
+    size_t dead_metadata_bytes = 0; ///< Тексты в хранилищах, заменённые updateMetadata и ещё не вычищенные.
+    uint64_t next_id = 1; ///< Следующий свободный ID (ID выдаются подряд, 0 - недействительный ID).
+    std::shared_ptr<MappedFile> mapping;          ///< Отображение файла, на которое ссылаются сегменты.
+    std::shared_ptr<HotRowCache> hot_rows;        ///< Кэш горячих строк отображения (многоуровневый режим).
+
+    const VectorSegment &segment(size_t row) const
+    {
+        return *segments[row / segment_rows];
+    }
+};
+
 /**
  * @brief Класс, реализующий простую векторную базу данных с возможностью сохранения на диск.
  *
  * Поддерживает добавление эмбеддингов, поиск по схожести (косинусное расстояние),
  * управление метаданными и загрузку/сохранение состояния в файл.
+ *
+ * Чтение не блокируется: поиск и выборка метаданных работают с неизменяемым снимком,
+ * который атомарно загружается из current. Писатели сериализуются write_mutex, дописывают
+ * строки в растущий последний сегмент и атомарно публикуют новый снимок. Старый снимок
+ * освобождается, когда его отпускает последний читатель.
+ *
+ * БД может быть выгружена из памяти (current == nullptr): тогда первое обращение к данным
+ * загружает её из файла. Если загрузка не удалась, БД остаётся выгруженной, а обращение
+ * завершается исключением: файл не перезаписывается пустой БД.
  */
 class VectorDatabase
 {
 private:
-    std::string filename;              ///< Имя файла для сохранения/загрузки базы данных.
-    size_t dimension;                  ///< Размерность векторов в базе (должна быть фиксированной).
-    std::vector<VectorRecord> vectors; ///< Хранилище всех векторных записей.
+    std::string filename; ///< Имя файла для сохранения/загрузки базы данных.
+    size_t dimension;     ///< Размерность векторов в базе (должна быть фиксированной).
+    /// Текущий снимок (только через std::atomic_load/atomic_store); nullptr - БД выгружена из памяти.
+    mutable std::shared_ptr<const VectorSnapshot> current;
     bool modified; ///< Флаг, указывающий, были ли внесены изменения с момента последней загрузки/сохранения.
-    std::unordered_map<uint32_t, size_t> id_to_index; ///< Карта для быстрого поиска индекса записи по её ID.
+    mutable std::atomic<uint64_t> rewrite_epoch{0}; ///< Счётчик изменений существующих строк (удаление, правка метаданных, загрузка).
+    std::atomic<size_t> file_rows{0}; ///< Количество записей в файле, пока БД выгружена.
+    mutable std::atomic<uint64_t> load_total{0}; ///< Объём данных загружаемого файла в байтах.
+    mutable std::atomic<uint64_t> load_done{0};  ///< Сколько байт уже прочитано.
+    float compaction_threshold;       ///< Доля удалённых строк, после которой запускается уплотнение.
+    std::future<void> compaction;     ///< Фоновое уплотнение.
+    MappingOptions mapping_options;   ///< Параметры отображения файла (под write_mutex).
+    mutable std::atomic<bool> embedding_compression{false}; ///< Сохранять эмбеддинги сжатыми.
+    /// Размещение новых сегментов (только через std::atomic_load/atomic_store).
+    std::shared_ptr<const MemoryOptions> memory_options;
+    mutable std::future<void> warmup; ///< Фоновый прогрев отображения.
+    mutable std::mutex write_mutex;   ///< Сериализует писателей и загрузку.
+
+    static constexpr size_t invalid_row = std::numeric_limits<size_t>::max();
+
+    /**
+     * @brief Расположение секции метаданных в файле.
+     */
+    struct MetadataSection
+    {
+        uint64_t blob_offset = 0;            ///< Начало текстов (версия 2) или сжатых блоков (версия 3).
+        std::vector<uint64_t> offsets;       ///< Смещения текстов строк в распакованных данных (count + 1).
+        std::vector<uint64_t> block_rows;    ///< Первые строки блоков (blocks + 1); пусто - тексты без сжатия.
+        std::vector<uint64_t> block_offsets; ///< Смещения сжатых блоков от blob_offset (blocks + 1).
+    };
+
+    /**
+     * @brief Расположение секции эмбеддингов в файле.
+     */
+    struct EmbeddingSection
+    {
+        uint64_t offset = 0;                 ///< Начало эмбеддингов или сжатых блоков.
+        std::vector<uint64_t> block_offsets; ///< Смещения блоков сегментов (segments + 1); пусто - без сжатия.
+    };
 
 public:
     /**
@@ -45,17 +200,73 @@ public:
     VectorDatabase(const std::string &db_filename, size_t dim);
 
     /**
-     * @brief Деструктор, автоматически сохраняет изменения при необходимости.
+     * @brief Деструктор, дожидается фоновых уплотнения и прогрева и автоматически сохраняет изменения при необходимости.
      */
     ~VectorDatabase();
 
     /**
      * @brief Инициализирует базу данных: загружает данные с диска или создаёт новую, если файл отсутствует.
      *
-     * @return true, если инициализация прошла успешно; false — в случае ошибки.
+     * @return true, если инициализация прошла успешно; false — в случае ошибки
+     *         (в том числе если файл есть, но не прочитан: он не перезаписывается).
      */
     bool initialize();
 
+    /**
+     * @brief Подключает существующий файл БД без загрузки данных.
+     *
+     * Читается только заголовок; данные загружаются при первом обращении.
+     *
+     * @return true, если файл существует и размерность совпадает.
+     */
+    bool attach();
+
+    /**
+     * @brief Загружает данные в память, если БД выгружена.
+     */
+    void makeResident() const;
+
+    /**
+     * @brief Выгружает данные из памяти, предварительно сохранив изменения.
+     *
+     * Запросы, уже получившие снимок, дорабатывают с ним; следующее обращение загрузит БД заново.
+     *
+     * @return true, если БД выгружена.
+     */
+    bool unload();
+
+    /**
+     * @brief Загружены ли данные в память.
+     */
+    bool isResident() const;
+
+    /**
+     * @brief Оценка занимаемой памяти в байтах (0, если БД выгружена).
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * @brief Оценка памяти после загрузки: для выгруженной БД - по количеству записей в файле.
+     *
+     * Метаданные не учитываются: их объём неизвестен без чтения файла.
+     */
+    size_t estimatedMemoryUsage() const;
+
+    /**
+     * @brief Доля прочитанных данных файла при загрузке (1 - БД загружена).
+     */
+    float loadProgress() const;
+
+    /**
+     * @brief Читает размерность и количество записей из заголовка файла БД.
+     *
+     * @param path Путь к файлу.
+     * @param dimension Размерность векторов.
+     * @param count Количество записей.
+     * @return true, если заголовок прочитан.
+     */
+    static bool readHeader(const std::string &path, size_t &dimension, size_t &count);
+
     /**
      * @brief Добавляет новый эмбеддинг в базу данных.
      *
@@ -63,7 +274,30 @@ public:
      * @param metadata Дополнительные метаданные (по умолчанию — пустая строка).
      * @return Уникальный идентификатор добавленной записи.
      */
-    uint32_t addEmbedding(const std::vector<float> &embedding, const std::string &metadata = "");
+    uint64_t addEmbedding(const std::vector<float> &embedding, const std::string &metadata = "");
+
+    /**
+     * @brief Добавляет пакет эмбеддингов, записанных подряд в одном буфере.
+     *
+     * Строки копируются прямо в сегменты базы и публикуются одним снимком.
+     *
+     * @param data Матрица count x dimension (построчно).
+     * @param count Количество строк.
+     * @param metadata Метаданные строк (пустой вектор или ровно count элементов).
+     * @return ID добавленных записей в порядке строк; пустой вектор при ошибке.
+     */
+    std::vector<uint64_t> addEmbeddings(const float *data, size_t count, const std::vector<std::string> &metadata);
+
+    /**
+     * @brief Массовое добавление записей.
+     *
+     * Место в сегментах выделяется один раз, строки нормализуются параллельно, ID выдаются
+     * пакетом, метаданные копируются в хранилище сегмента. Поле `id` записей игнорируется.
+     *
+     * @param batch Записи для добавления (после вызова пуст).
+     * @return ID добавленных записей в порядке пакета; пустой вектор при ошибке.
+     */
+    std::vector<uint64_t> addEmbeddings(std::vector<VectorRecord> &&batch);
 
     /**
      * @brief Находит K наиболее похожих записей по отношению к заданному запросу (эмбеддингу).
@@ -75,13 +309,142 @@ public:
      * @param similarity_threshold Порог сходства: возвращаются только записи с сходством ≥ порога (по умолчанию 0.0).
      * @return Вектор пар: (ID записи, сходство). Сходство ∈ [–1, 1].
      */
-    std::vector<std::pair<uint32_t, float>> findTopK(const std::vector<float> &query,
+    std::vector<std::pair<uint64_t, float>> findTopK(const std::vector<float> &query,
                                                      uint32_t k = 5,
-                                                     float similarity_threshold = 0.0f);
+                                                     float similarity_threshold = 0.0f) const;
+
+    /**
+     * @brief Поиск K наиболее похожих записей в заданном снимке.
+     *
+     * Позволяет прочитать позиции и метаданные найденных записей из того же снимка,
+     * по которому они ранжировались.
+     *
+     * @param snapshot Снимок, полученный из snapshot().
+     */
+    std::vector<std::pair<uint64_t, float>> findTopK(const VectorSnapshot &snapshot,
+                                                     const std::vector<float> &query,
+                                                     uint32_t k = 5,
+                                                     float similarity_threshold = 0.0f) const;
+
+    /**
+     * @brief Поиск K ближайших записей для пакета запросов.
+     *
+     * Результаты пишутся в буферы вызывающей стороны размером n_queries x k.
+     * Если подходящих записей меньше k, оставшиеся позиции заполняются ID 0 и сходством NaN.
+     * Все запросы пакета выполняются по одному снимку.
+     *
+     * @param queries Матрица запросов n_queries x dimension (построчно).
+     * @param n_queries Количество запросов.
+     * @param k Количество записей на запрос.
+     * @param similarity_threshold Порог сходства.
+     * @param out_ids Буфер для ID.
+     * @param out_scores Буфер для значений сходства.
+     * @return true, если поиск выполнен; false — при пустом k.
+     */
+    bool findTopKBatch(const float *queries,
+                       size_t n_queries,
+                       uint32_t k,
+                       float similarity_threshold,
+                       uint64_t *out_ids,
+                       float *out_scores) const;
+
+    /**
+     * @brief Удаляет запись.
+     *
+     * Строка помечается в битовой карте удалённых и пропускается при поиске; память
+     * освобождается при уплотнении.
+     *
+     * @param id Уникальный идентификатор записи.
+     * @return true, если запись существовала и удалена.
+     */
+    bool remove(uint64_t id);
+
+    /**
+     * @brief Удаляет все записи, удовлетворяющие условию.
+     *
+     * Условие вычисляется по снимку без блокировки и может обращаться к этой же БД;
+     * записи, удалённые или добавленные за это время, не учитываются.
+     *
+     * @param filter Условие от (ID, метаданные).
+     * @return Количество удалённых записей.
+     */
+    size_t removeWhere(const std::function<bool(uint64_t, std::string_view)> &filter);
+
+    /**
+     * @brief Уплотнение: переписывает живые строки в новые сегменты и перестраивает индекс.
+     *
+     * Копирование идёт по снимку без блокировок, поэтому ни поиск, ни добавление не останавливаются;
+     * write_mutex берётся только на перенос строк, добавленных за время копирования, и публикацию.
+     * Если за время копирования записи удалялись или менялись, результат отбрасывается.
+     *
+     * @return true, если уплотнение выполнено.
+     */
+    bool compact();
+
+    /**
+     * @brief Устанавливает долю удалённых строк, после которой уплотнение запускается в фоне.
+     *
+     * @param ratio Доля в (0, 1]; 0 - не запускать автоматически.
+     */
+    void setCompactionThreshold(float ratio);
+
+    /**
+     * @brief Параметры отображения файла в память.
+     *
+     * Применяются при следующей загрузке; закрепление (lock) применяется сразу.
+     * В режиме отображения ID и эмбеддинги читаются из страниц файла по требованию,
+     * добавленные строки хранятся в куче.
+     */
+    void setMappingOptions(const MappingOptions &options);
+    MappingOptions getMappingOptions() const;
+
+    /**
+     * @brief Хранить эмбеддинги в файле сжатыми без потерь (для архивных и редко используемых БД).
+     *
+     * Сегменты сжимаются независимо при сохранении и распаковываются параллельно при загрузке;
+     * значения восстанавливаются побитово, поэтому результаты поиска не меняются. Такой файл
+     * всегда загружается в кучу, без отображения. При загрузке режим берётся из файла; смена
+     * режима загружает БД и помечает её изменённой, чтобы файл был перезаписан.
+     */
+    void setEmbeddingCompression(bool enabled);
+    bool getEmbeddingCompression() const;
+
+    /**
+     * @brief Прогрев отображённых страниц в фоне: madvise(WILLNEED) и параллельное чтение страниц.
+     *
+     * После прогрева первый запрос не ждёт чтения страниц с диска.
+     *
+     * @param wait Дождаться окончания прогрева.
+     */
+    void warmUp(bool wait = false);
+
+    /**
+     * @brief Закрепление отображённых страниц в памяти (mlock) или снятие закрепления.
+     *
+     * @return true, если состояние изменено (mlock может не хватить RLIMIT_MEMLOCK).
+     */
+    bool setLocked(bool locked);
+
+    /**
+     * @brief Отображены ли данные из файла.
+     */
+    bool isMapped() const;
+
+    /**
+     * @brief Размещение матрицы эмбеддингов: огромные страницы и распределение по узлам NUMA.
+     *
+     * Действует на сегменты, выделенные после вызова (добавление, загрузка, уплотнение).
+     * В режиме NUMA сегмент i размещается на узле i % nodeCount(), а поиск сканирует
+     * сегменты каждого узла потоками, привязанными к этому узлу.
+     */
+    void setMemoryOptions(const MemoryOptions &options);
+    MemoryOptions getMemoryOptions() const;
 
     /**
      * @brief Сохраняет текущее состояние базы данных на диск.
      *
+     * Перед записью удалённые строки вычищаются.
+     *
      * @return true, если сохранение прошло успешно; false — в случае ошибки.
      */
     bool save();
@@ -89,6 +452,8 @@ public:
     /**
      * @brief Загружает состояние базы данных с диска.
      *
+     * Файлы старого формата (без заголовка) тоже читаются; их записи получают новые ID.
+     *
      * @return true, если загрузка прошла успешно; false — в случае ошибки или отсутствия файла.
      */
     bool load();
@@ -96,20 +461,72 @@ public:
     /**
      * @brief Возвращает текущее количество записей в базе.
      *
-     * @return Количество векторов.
+     * @return Количество векторов без учёта удалённых.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Количество строк текущего снимка, включая удалённые до уплотнения.
      */
-    size_t size() const
+    size_t rowCount() const;
+
+    /**
+     * @brief Возвращает размерность эмбеддингов.
+     */
+    size_t getDimension() const
     {
-        return vectors.size();
+        return dimension;
     }
 
+    /**
+     * @brief Текущий снимок (при необходимости БД загружается).
+     *
+     * Данные снимка не меняются и остаются доступными, пока жив возвращённый указатель.
+     *
+     * @throws std::runtime_error, если выгруженную БД не удалось загрузить
+     */
+    std::shared_ptr<const VectorSnapshot> snapshot() const;
+
     /**
      * @brief Получает метаданные для записи по её идентификатору.
      *
      * @param id Уникальный идентификатор записи.
      * @return Строка с метаданными. Возвращает пустую строку, если ID не найден.
      */
-    std::string getMetadata(uint32_t id) const;
+    std::string getMetadata(uint64_t id) const;
+
+    /**
+     * @brief Метаданные записи в снимке без копирования.
+     *
+     * Сжатые метаданные распаковываются блоком, в котором лежит запись; при чтении
+     * нескольких записей подряд один и тот же block переиспользуется.
+     *
+     * @param snapshot Снимок, полученный из snapshot().
+     * @param id Уникальный идентификатор записи.
+     * @param block Держатель распакованного блока.
+     * @return Метаданные, действительные, пока живы snapshot и block; пустая строка, если ID не найден.
+     */
+    static std::string_view getMetadata(const VectorSnapshot &snapshot, uint64_t id, MetadataBlock &block);
+
+    /**
+     * @brief Возвращает позицию записи в базе (порядок добавления).
+     *
+     * Записи одного документа добавляются подряд, поэтому соседние позиции
+     * соответствуют соседним фрагментам текста.
+     *
+     * @param id Уникальный идентификатор записи.
+     * @return Позиция записи или rowCount(), если ID не найден.
+     */
+    size_t getPosition(uint64_t id) const;
+
+    /**
+     * @brief Позиция записи в снимке.
+     *
+     * @param snapshot Снимок, полученный из snapshot().
+     * @param id Уникальный идентификатор записи.
+     * @return Позиция записи или snapshot.rows, если ID не найден или запись удалена.
+     */
+    static size_t getPosition(const VectorSnapshot &snapshot, uint64_t id);
 
     /**
      * @brief Обновляет метаданные для существующей записи.
@@ -118,7 +535,7 @@ public:
      * @param new_metadata Новые метаданные.
      * @return true, если запись с таким ID существует и обновление выполнено; false — иначе.
      */
-    bool updateMetadata(uint32_t id, const std::string &new_metadata);
+    bool updateMetadata(uint64_t id, const std::string &new_metadata);
 
     /**
      * @brief Возвращает имя файла, ассоциированного с базой данных.
@@ -129,29 +546,234 @@ public:
 
 private:
     /**
-     * @brief Вычисляет косинусное сходство между двумя векторами.
+     * @brief Вычисляет косинусное сходство между двумя нормализованными векторами размерности `dimension`.
      *
      * @param a Первый вектор.
      * @param b Второй вектор.
      * @return Значение косинусного сходства ∈ [–1, 1].
      */
-    float cosineSimilarity(const std::vector<float> &a, const std::vector<float> &b) const;
+    float cosineSimilarity(const float *a, const float *b) const;
 
     /**
-     * @brief Нормализует вектор до единичной длины (L2-норма).
+     * @brief Нормализует вектор размерности `dimension` до единичной длины (L2-норма).
      *
      * Модифицирует переданный вектор на месте.
      *
      * @param vector Вектор для нормализации.
      */
-    void normalizeVector(std::vector<float> &vector) const;
+    void normalizeVector(float *vector) const;
+
+    /**
+     * @brief Поиск K ближайших записей снимка для одного нормализованного запроса.
+     */
+    std::vector<std::pair<uint64_t, float>> searchNormalized(const VectorSnapshot &snapshot,
+                                                             const float *query,
+                                                             uint32_t k,
+                                                             float similarity_threshold) const;
+
+    /**
+     * @brief Сканирование живых строк сегмента index снимка.
+     *
+     * @param approximate Квантованный запрос: строки сегмента с int8-копией сравниваются
+     *                    приближённо, с запасом к порогу (nullptr - только точное сравнение).
+     * @param out Найденные пары (ID, сходство) не ниже порога дописываются сюда.
+     */
+    void scanSegment(const VectorSnapshot &snapshot,
+                     size_t index,
+                     const float *query,
+                     const QuantizedQuery *approximate,
+                     float similarity_threshold,
+                     std::vector<std::pair<uint64_t, float>> &out) const;
+
+    /**
+     * @brief Параллельное сканирование: сегменты каждого узла NUMA обходят потоки этого узла.
+     *
+     * @return Лучшие k кандидатов каждого потока (не упорядочены между потоками).
+     */
+    std::vector<std::pair<uint64_t, float>> scanNuma(const VectorSnapshot &snapshot,
+                                                     const float *query,
+                                                     const QuantizedQuery *approximate,
+                                                     size_t k,
+                                                     float similarity_threshold) const;
+
+    /**
+     * @brief Точное сходство кандидатов приближённого этапа.
+     *
+     * Полные векторы берутся из кэша горячих строк; промахи запрашиваются у ядра одним
+     * пакетом (madvise WILLNEED читает страницы асинхронно) до вычисления сходства.
+     *
+     * @param candidates Пары (ID, сходство): сходство заменяется точным.
+     */
+    void rerank(const VectorSnapshot &snapshot,
+                const float *query,
+                std::vector<std::pair<uint64_t, float>> &candidates) const;
+
+    /**
+     * @brief Строка записи по ID.
+     *
+     * @return Номер строки или invalid_row, если ID не найден или запись удалена.
+     */
+    static size_t findRow(const VectorSnapshot &snapshot, uint64_t id);
+
+    /**
+     * @brief Публикует новый снимок (при захваченном write_mutex).
+     */
+    void publish(std::shared_ptr<const VectorSnapshot> next) const;
+
+    /**
+     * @brief Текущий снимок при захваченном write_mutex; выгруженная БД загружается из файла.
+     *
+     * @throws std::runtime_error, если файл не прочитан (БД остаётся выгруженной)
+     */
+    std::shared_ptr<const VectorSnapshot> residentSnapshot() const;
+
+    /**
+     * @brief Путь к файлу БД: имена без каталога хранятся в ./db.
+     */
+    std::string filePath() const;
+
+    /**
+     * @brief Чтение файла БД в новый снимок.
+     *
+     * @param legacy Признак файла старого формата.
+     * @return Снимок или nullptr при ошибке.
+     */
+    std::shared_ptr<VectorSnapshot> readFile(bool &legacy, const MappingOptions &options) const;
+
+    /**
+     * @brief Запуск фонового прогрева отображения снимка (при захваченном write_mutex).
+     */
+    void startWarmUp(const VectorSnapshot &snapshot) const;
+
+    /**
+     * @brief Чтение строк [first_row, first_row + count) файла нового формата в подготовленный снимок.
+     *
+     * Каждый вызов открывает файл заново, поэтому диапазоны читаются параллельно.
+     *
+     * @param ids_offset Смещение секции ID в файле.
+     * @param embeddings Расположение эмбеддингов в файле.
+     * @param metadata Расположение метаданных в файле.
+     * @param read_vectors Читать ID и эмбеддинги (false - они отображены из файла).
+     * @return true, если диапазон прочитан.
+     */
+    bool readRows(uint64_t ids_offset,
+                  const EmbeddingSection &embeddings,
+                  const MetadataSection &metadata,
+                  VectorSnapshot &snapshot,
+                  size_t first_row,
+                  size_t count,
+                  bool read_vectors) const;
+
+    /**
+     * @brief Сжатые метаданные строк [first_row, first_row + count) по сегментам.
+     *
+     * Блоки сегмента читаются одним вызовом, а при отображении файла ссылаются на его страницы.
+     */
+    void readPackedRows(std::ifstream &file,
+                        const MetadataSection &metadata,
+                        VectorSnapshot &snapshot,
+                        size_t first_row,
+                        size_t count) const;
+
+    /**
+     * @brief Распаковка эмбеддингов строк [first_row, first_row + count) по сегментам.
+     *
+     * @return false, если блок повреждён.
+     */
+    bool readPackedEmbeddings(std::ifstream &file,
+                              const EmbeddingSection &embeddings,
+                              VectorSnapshot &snapshot,
+                              size_t first_row,
+                              size_t count) const;
+
+    /**
+     * @brief Чтение и проверка таблицы блоков эмбеддингов; embeddings.offset сдвигается на начало блоков.
+     *
+     * @return false, если таблица повреждена или блоки не доходят ровно до метаданных.
+     */
+    static bool readEmbeddingTable(std::ifstream &file,
+                                   uint64_t count,
+                                   uint64_t metadata_offset,
+                                   EmbeddingSection &embeddings);
+
+    /**
+     * @brief Чтение и проверка таблицы сжатых блоков (файл стоит сразу за смещениями метаданных).
+     *
+     * @return false, если таблица повреждена или блоки выходят за конец файла.
+     */
+    static bool readBlockTable(std::ifstream &file, MetadataSection &metadata);
+
+    /**
+     * @brief Вычищает удалённые строки и записывает файл (при захваченном write_mutex).
+     */
+    bool saveLocked();
+
+    /**
+     * @brief Обеспечивает место под count строк после snapshot.rows.
+     *
+     * Последний сегмент растёт удвоением до полной ёмкости (копией, старые снимки
+     * продолжают видеть прежний сегмент), дальше добавляются новые сегменты.
+     */
+    void reserveRows(VectorSnapshot &snapshot, size_t count) const;
+
+    /**
+     * @brief Записывает в индекс строки [first_row, first_row + count) по их ID.
+     */
+    static void indexRows(VectorSnapshot &snapshot, size_t first_row, size_t count);
+
+    /**
+     * @brief Добавление count строк: fill(i, строка, метаданные) заполняет i-ю строку.
+     *
+     * Метаданные, на которые указывает fill, копируются в хранилище сегмента.
+     * Строки нормализуются, получают ID и публикуются одним снимком. Вызывается при захваченном write_mutex.
+     */
+    std::vector<uint64_t> appendRows(size_t count,
+                                     const std::function<void(size_t, float *, std::string_view &)> &fill);
+
+    /**
+     * @brief Помечает удалённой строку снимка.
+     */
+    static void markDead(const VectorSnapshot &snapshot, size_t row);
+
+    /**
+     * @brief Запускает фоновое уплотнение, если доля удалённых строк или заменённых текстов превысила порог.
+     *
+     * Вызывается при захваченном write_mutex.
+     */
+    void scheduleCompaction(const VectorSnapshot &snapshot);
+
+    /**
+     * @brief Копирует живые строки [first_row, first_row + count) снимка source в конец target.
+     */
+    void copyLiveRows(const VectorSnapshot &source, size_t first_row, size_t count, VectorSnapshot &target) const;
+
+    /**
+     * @brief Записывает снимок в файл в текущем формате.
+     *
+     * Запись идёт во временный файл, который затем заменяет path: отображения прежнего
+     * файла остаются действительными.
+     *
+     * @param snapshot Снимок без удалённых строк.
+     * @param path Путь к файлу.
+     * @return true, если запись прошла успешно.
+     */
+    bool writeFile(const VectorSnapshot &snapshot, const std::string &path) const;
+
+    /**
+     * @brief Загрузка файла старого формата (size_t размерность, uint32 количество, записи подряд).
+     *
+     * @param file Поток, установленный на начало файла.
+     * @param snapshot Пустой снимок для загруженных строк.
+     */
+    bool loadLegacy(std::ifstream &file, VectorSnapshot &snapshot) const;
 
     /**
-     * @brief Генерирует новый уникальный идентификатор для записи.
+     * @brief Параллельная нормализация подряд идущих строк.
      *
-     * @return Новый ID (гарантированно не повторяется в текущей сессии).
+     * @param rows Указатель на первую строку.
+     * @param count Количество строк.
      */
-    uint32_t generateId() const;
+    void normalizeRows(float *rows, size_t count) const;
 };
 
 #endif // VECTOR_DB_H